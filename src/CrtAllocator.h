@@ -8,5 +8,6 @@ public:
 	~CrtAllocator();
 
 	void* Allocate(const mem_size_t& size);
+	void* AllocateZeroed(const mem_size_t& size);
 	void Free(void* ptr);
 };
\ No newline at end of file
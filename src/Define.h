@@ -1,6 +1,9 @@
 #pragma once
 #include <stdint.h>
+#include <stddef.h>
+#ifdef _MSC_VER
 #include <intrin.h>
+#endif
 
 typedef size_t mem_size_t;
 
@@ -13,6 +16,7 @@ constexpr mem_size_t kMaxSize = 0xffffffff;
 
 constexpr mem_size_t kAlignment = 16 BYTE;
 constexpr mem_size_t kPageSize = 4 KB;
+constexpr mem_size_t kPageShift = 12;
 
 enum class PlacementPolicy
 {
@@ -27,11 +31,40 @@ enum class CoalescingPolicy
 	kDeferred
 };
 
+// allocation hint, long-lived objects grow from the bottom of a heap and short-lived ones from the top
+enum class Lifetime
+{
+	kDefault,
+	kShort,
+	kLong
+};
+
 inline mem_size_t RoundUp(const mem_size_t& alignment, const mem_size_t& size) noexcept
 {
 	return (size + alignment - 1) & ~(alignment - 1);
 }
 
+// per-instance seed, so two samplers created back to back don't draw the same sequence
+inline uint64_t SeedRandom(const void* instance) noexcept
+{
+	return 0x9e3779b97f4a7c15ull ^ static_cast<uint64_t>(reinterpret_cast<mem_size_t>(instance));
+}
+
+// xorshift64*
+inline uint64_t NextRandom(uint64_t& state) noexcept
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return state * 0x2545f4914f6cdd1dull;
+}
+
+// uniform in [1, 2 * rate], a randomized countdown neither aliases with periodic allocation patterns nor can be predicted from call order
+inline mem_size_t NextSampleDistance(uint64_t& state, const mem_size_t& rate) noexcept
+{
+	return static_cast<mem_size_t>(NextRandom(state) % (rate << 1)) + 1;
+}
+
 inline mem_size_t FindLastBitSetImpl(mem_size_t bits) noexcept
 {
 	mem_size_t bit = 64;
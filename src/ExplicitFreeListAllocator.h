@@ -1,5 +1,10 @@
 #pragma once
 #include "Define.h"
+#include "PageMap.h"
+#include "HeapProfiler.h"
+#include "GuardedPool.h"
+#include "VirtualMemory.h"
+#include <vector>
 
 class ExplicitFreeListAllocator 
 {
@@ -9,40 +14,157 @@ public:
 		mem_size_t size_and_flag;
 	};
 
+	// free list links are offsets from the heap base so the heap can be mapped at any address,
+	// dirty_size is the prefix of a free span's payload that may hold non-zero bytes, the rest is known zero
 	struct Span
 	{
 		BoundaryTag tag;
-		Span* prev;
-		Span* next;
+		mem_size_t prev;
+		mem_size_t next;
+		mem_size_t dirty_size;
+	};
+
+	// lives at offset 0 of every heap, so offset 0 doubles as the null link
+	struct HeapHeader
+	{
+		uint64_t magic;
+		uint64_t version;
+		mem_size_t capacity;
+		mem_size_t free_list;
+		mem_size_t root;
+		uint64_t clean_shutdown;
+		// span range whose tags are being rewritten, Recover turns an interrupted one back into a free span
+		mem_size_t pending_start;
+		mem_size_t pending_end;
 	};
 
 	typedef BoundaryTag* BoundaryTagPointer;
 	typedef Span* SpanPointer;
+	typedef mem_size_t Handle;
+	typedef void (*AllocationVisitor)(void* ptr, const mem_size_t& size, void* context);
+
+	static constexpr Handle kInvalidHandle = ~static_cast<Handle>(0);
+	static constexpr mem_size_t kNullOffset = 0;
 
 public:
+	// throws std::bad_alloc when the heap can't be mapped
 	ExplicitFreeListAllocator(const mem_size_t& capacity);
 	ExplicitFreeListAllocator(const mem_size_t& capacity, const PlacementPolicy& placement_policy);
 	ExplicitFreeListAllocator(const mem_size_t& capacity, const PlacementPolicy& placement_policy, const CoalescingPolicy& coalescing_policy);
+	// Persistent heap backed by a memory-mapped file. A new file is created with capacity bytes and formatted.
+	// An existing heap file is reattached as is after a clean shutdown, otherwise its free list is rebuilt from
+	// the boundary tags. Throws std::runtime_error when the file can't be mapped or isn't a heap of this version and capacity.
+	ExplicitFreeListAllocator(const char* path, const mem_size_t& capacity);
+	ExplicitFreeListAllocator(const char* path, const mem_size_t& capacity, const PlacementPolicy& placement_policy, const CoalescingPolicy& coalescing_policy);
+	// Heap over caller owned, page aligned memory, e.g. a shared memory segment. With format the memory is
+	// formatted, otherwise the heap it already holds is attached as is and std::runtime_error is thrown when it
+	// doesn't hold one. The caller is responsible for calling Recover if the owner died mid-flight.
+	ExplicitFreeListAllocator(void* memory, const mem_size_t& capacity, bool format);
 	~ExplicitFreeListAllocator();
 
 	void* Allocate(const mem_size_t& size);
+	// keeps short-lived allocations from landing between long-lived ones, kDefault follows the placement policy
+	void* Allocate(const mem_size_t& size, const Lifetime& lifetime);
+	// Places the allocation as close as possible to hint, a live allocation of this heap, preferring free spans
+	// in the same 64 KB neighbourhood. Falls back to the placement policy when nothing nearby fits.
+	void* AllocateNear(void* hint, const mem_size_t& size);
+	// zero-filled allocation, only the part of the span not known to be zero is cleared
+	void* AllocateZeroed(const mem_size_t& size);
 	void Free(void* ptr);
+	// region is ptr's page map entry, lets a composite allocator that already looked it up skip a second lookup
+	void Free(void* ptr, const Region* region);
+
+	// Relocatable allocations. Resolve a handle to its current address, the address stays valid
+	// until the next Compact unless the handle is pinned.
+	Handle AllocateMovable(const mem_size_t& size);
+	void FreeMovable(const Handle& handle);
+	void* Resolve(const Handle& handle);
+	void Pin(const Handle& handle);
+	void Unpin(const Handle& handle);
+
+	// Slides unpinned movable spans toward heap_start_address_, spending roughly budget bytes of work
+	// per call. Returns true once a full pass over the heap is done.
+	bool Compact(const mem_size_t& budget);
+
+	mem_size_t GetLargestFreeSpan();
+	mem_size_t GetFreeSize();
+	// returns the whole free pages of an anonymous heap to the OS, so they come back known zero. Returns the bytes purged.
+	mem_size_t Purge();
+
+	// entry point into a persistent heap, stored as an offset in the heap header
+	void* GetRoot();
+	void SetRoot(void* ptr);
+	// true when an existing heap file was reattached instead of formatted
+	bool IsWarmStart();
+	// writes dirty pages of a persistent heap back to its file
+	void Flush();
+	// Rebuilds the free list from the boundary tags, after undoing a split or merge cut short by a crash.
+	// Throws std::runtime_error when the tags are corrupt beyond that.
+	void Recover();
+	// calls visitor for every allocated span, the heap must not be modified while visiting
+	void ForEachAllocation(AllocationVisitor visitor, void* context);
 
 	bool Contains(const mem_size_t& address);
+	// true when ptr is a live allocation of this heap
+	bool Owns(void* ptr);
+
+	// sampled allocations are attributed to their call sites, nullptr disables profiling
+	void SetProfiler(HeapProfiler* profiler);
+	// a sampled fraction of allocations is served from guard-page slots, nullptr disables it
+	void SetGuardedPool(GuardedPool* guarded_pool);
 
 private:
+	enum class Backing
+	{
+		kAnonymous,
+		kFile,
+		kExternal
+	};
+
+	struct HandleEntry
+	{
+		mem_size_t span_address;
+		mem_size_t pin_count;
+	};
+
 	PlacementPolicy placement_policy_;
 	CoalescingPolicy coalescing_policy_;
-	SpanPointer free_list_;
+	HeapHeader* header_;
 	SpanPointer last_fit_;
 	void* heap_;
+	Backing backing_;
+	bool warm_start_;
+	VirtualMemory::MappedFile mapped_file_;
 	mem_size_t heap_start_address_;
 	mem_size_t heap_end_;
+	// from PageMap::NewRegion, so lookups racing with destruction never touch freed memory
+	Region* region_;
+	HeapProfiler* profiler_;
+	GuardedPool* guarded_pool_;
+	std::vector<HandleEntry> handles_;
+	std::vector<Handle> free_handles_;
+	mem_size_t compact_cursor_;
+
+	void Initialize(const mem_size_t& capacity, const PlacementPolicy& placement_policy, const CoalescingPolicy& coalescing_policy);
+	void Format(bool zeroed);
+	SpanPointer ToSpan(const mem_size_t& offset);
+	mem_size_t ToOffset(const SpanPointer& span);
+	mem_size_t GetFirstSpanAddress();
+
+	void* AllocatePayload(const mem_size_t& size, const Lifetime& lifetime, bool zeroed);
+	void AllocateSpan(const mem_size_t& aligned_size, const Lifetime& lifetime, SpanPointer& span, mem_size_t& dirty_size);
+	void CarveSpan(const mem_size_t& aligned_size, bool from_top, SpanPointer& span, mem_size_t& dirty_size);
+	void SlideLeft(SpanPointer& free_span, SpanPointer& movable_span);
+	void BeginTagUpdate(const mem_size_t& start_address, const mem_size_t& end_address);
+	void EndTagUpdate();
 
 	void Find(const mem_size_t& aligned_size, SpanPointer& found);
 	void FindFirstFit(const mem_size_t& aligned_size, SpanPointer& found);
 	void FindNextFit(const mem_size_t& aligned_size, SpanPointer& found);
 	void FindBestFit(const mem_size_t& aligned_size, SpanPointer& found);
+	void FindLowestFit(const mem_size_t& aligned_size, SpanPointer& found);
+	void FindHighestFit(const mem_size_t& aligned_size, SpanPointer& found);
+	void FindNearFit(const mem_size_t& hint_address, const mem_size_t& aligned_size, SpanPointer& found, bool& from_top);
 	void InsertToFreeList(const mem_size_t& address, SpanPointer& span);
 	void RemoveFromFreeList(SpanPointer& span);
 	void Coalesce(SpanPointer& span, SpanPointer& merged_span, mem_size_t& merged_span_address);
@@ -56,6 +178,14 @@ private:
 
 	SpanPointer CreateSpan(const mem_size_t& address, const mem_size_t& size);
 	bool IsFree(const BoundaryTag& tag);
+	bool IsSampled(const BoundaryTag& tag);
+	void SetSampled(const mem_size_t& address, SpanPointer& span, bool sampled);
+	bool IsMovable(const BoundaryTag& tag);
+	void SetMovable(const mem_size_t& address, SpanPointer& span, bool movable);
+	bool IsPinned(const mem_size_t& span_address);
+	bool IsAllocatedSpan(const mem_size_t& span_address);
+	mem_size_t GetDirtySize(const SpanPointer& span);
+	void SetDirtySize(SpanPointer& span, const mem_size_t& dirty_size);
 	mem_size_t GetSize(const BoundaryTag& tag);
 	void SetSize(BoundaryTag& tag, const mem_size_t& size);
 	void SetFlag(BoundaryTag& tag, bool allocated);
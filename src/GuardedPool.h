@@ -0,0 +1,86 @@
+#pragma once
+#include "Define.h"
+#include "PageMap.h"
+#include "StackTrace.h"
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Sampled guard-page allocations for catching heap corruption in production.
+// A small fraction of allocations is served from page sized slots flanked by inaccessible guard pages,
+// right-aligned so overflows fault immediately. Freed slots are protected and reused last, so
+// use-after-free faults as well. Faults, double frees and invalid frees are reported with the
+// allocating and freeing stacks before the process dies.
+class GuardedPool
+{
+public:
+	static constexpr mem_size_t kDefaultSlotCount = 64;
+	static constexpr mem_size_t kDefaultSampleRate = 1000;
+	static constexpr mem_size_t kMaxGuardedSize = kPageSize;
+
+	GuardedPool();
+	GuardedPool(const mem_size_t& slot_count, const mem_size_t& sample_rate);
+	~GuardedPool();
+
+	// fast path, an atomic countdown decrement for unsampled allocations, the pool may be shared between threads.
+	// Only the allocation that takes the countdown to zero is sampled, it restarts the countdown right away.
+	inline bool ShouldSample() noexcept
+	{
+		if (allocations_until_sample_.fetch_sub(1, std::memory_order_acquire) != 1)
+		{
+			return false;
+		}
+		RestartCountdown();
+		return true;
+	}
+
+	// returns nullptr when the size doesn't fit a slot or every slot is in use
+	void* Allocate(const mem_size_t& size);
+	void Free(void* ptr);
+
+	bool Owns(void* ptr);
+
+	// prints a report if address lies inside this pool, returns false otherwise.
+	// Async-signal-safe: no locks, no allocation, stack frames are printed as raw addresses.
+	bool ReportFault(const mem_size_t& address);
+
+private:
+	enum class SlotState
+	{
+		kUnused,
+		kAllocated,
+		kFreed
+	};
+
+	struct Slot
+	{
+		SlotState state;
+		mem_size_t address;
+		mem_size_t size;
+		StackTrace allocation_stack;
+		StackTrace free_stack;
+	};
+
+	std::vector<Slot> slots_;
+	std::deque<mem_size_t> free_slots_;
+	mem_size_t sample_rate_;
+	// at or below zero only while the sampling thread restarts it
+	std::atomic<int64_t> allocations_until_sample_;
+	uint64_t random_state_;
+	void* pool_;
+	mem_size_t pool_start_address_;
+	mem_size_t pool_end_;
+	// from PageMap::NewRegion, the fault handler may look it up while the pool is destroyed
+	Region* region_;
+	std::mutex mutex_;
+
+	// only the thread that reached zero runs this, so random_state_ is never shared
+	void RestartCountdown() noexcept;
+	mem_size_t GetSlotAddress(const mem_size_t& slot_index);
+	// symbolize must be false inside a fault handler
+	void Report(const char* error, const mem_size_t& address, const Slot* slot, bool symbolize);
+
+	GuardedPool(const GuardedPool& _pool) = delete;
+	GuardedPool(GuardedPool&& _pool) = delete;
+};
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+#include "Define.h"
+#include "StackTrace.h"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+// Sampling heap profiler. Roughly one allocation every sampling_interval bytes is sampled
+// (geometric sampling), its stack is recorded against the pointer until it is freed.
+// Profiles are dumped in collapsed stack format: "root;...;leaf bytes".
+class HeapProfiler
+{
+public:
+	static constexpr mem_size_t kDefaultSamplingInterval = 512 KB;
+
+	HeapProfiler();
+	HeapProfiler(const mem_size_t& sampling_interval);
+	~HeapProfiler();
+
+	// fast path, an atomic countdown decrement for unsampled allocations.
+	// Only the allocation that crosses zero is sampled, it restarts the countdown right away.
+	inline bool ShouldSample(const mem_size_t& size) noexcept
+	{
+		int64_t remaining = bytes_until_sample_.fetch_sub(static_cast<int64_t>(size), std::memory_order_acquire);
+		if (remaining > static_cast<int64_t>(size) || remaining <= 0)
+		{
+			return false;
+		}
+		RestartCountdown();
+		return true;
+	}
+
+	void RecordAllocation(void* ptr, const mem_size_t& size);
+	void RecordFree(void* ptr);
+
+	void DumpLiveHeap(std::ostream& out);
+	void DumpAllocations(std::ostream& out);
+
+private:
+	struct Sample
+	{
+		StackTrace stack;
+		mem_size_t size;
+		double weight;
+	};
+
+	struct Totals
+	{
+		double count;
+		double bytes;
+	};
+
+	typedef std::vector<void*> StackKey;
+
+	mem_size_t sampling_interval_;
+	// shared by every allocating thread, at or below zero only while the sampling thread restarts it
+	std::atomic<int64_t> bytes_until_sample_;
+	uint64_t random_state_;
+	std::unordered_map<void*, Sample> live_samples_;
+	std::map<StackKey, Totals> cumulative_;
+	std::mutex mutex_;
+
+	// only the thread that crossed zero runs this, so random_state_ is never shared
+	void RestartCountdown() noexcept;
+	mem_size_t NextSampleDistance() noexcept;
+	void Dump(const std::map<StackKey, Totals>& profile, std::ostream& out);
+
+	HeapProfiler(const HeapProfiler& _profiler) = delete;
+	HeapProfiler(HeapProfiler&& _profiler) = delete;
+};
\ No newline at end of file
@@ -0,0 +1,104 @@
+#pragma once
+#include "Define.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+enum class HeapKind
+{
+	kExplicitFreeList,
+	kSlab,
+	kDirect,
+	kGuarded
+};
+
+// a contiguous range of pages owned by one heap
+struct Region
+{
+	HeapKind kind;
+	void* owner;
+	mem_size_t start_address;
+	mem_size_t end_address;
+	// slab class index, 0 for other kinds
+	mem_size_t size_class;
+	// bytes to unmap for regions mapped on their own (direct), 0 for regions inside a heap's reservation
+	mem_size_t mapped_size;
+};
+
+// Global three-level radix tree from page number to owning region.
+// Lookups are lock-free, Register/Unregister are serialized and only happen when regions are mapped or unmapped.
+// Regions come from NewRegion and are type-stable like the tree nodes: a Lookup racing with Unregister may read
+// a deleted region, but its memory stays valid and a deleted region covers no address.
+class PageMap
+{
+public:
+	static constexpr mem_size_t kAddressBits = 48;
+	static constexpr mem_size_t kLevelBits = 12;
+	static constexpr mem_size_t kLevelLength = static_cast<mem_size_t>(1) << kLevelBits;
+	static constexpr mem_size_t kLevelMask = kLevelLength - 1;
+
+	static PageMap& Instance();
+
+	// never freed, DeleteRegion recycles it for the next NewRegion
+	Region* NewRegion();
+	void DeleteRegion(Region* region);
+
+	void Register(const Region* region);
+	void Unregister(const Region* region);
+
+	// returns the region containing address, nullptr for stray pointers
+	inline const Region* Lookup(const mem_size_t& address) const
+	{
+		if ((address >> kAddressBits) != 0)
+		{
+			return nullptr;
+		}
+
+		mem_size_t page = address >> kPageShift;
+
+		Interior* interior = root_[page >> (kLevelBits << 1)].load(std::memory_order_acquire);
+		if (interior == nullptr)
+		{
+			return nullptr;
+		}
+
+		Leaf* leaf = interior->leaves[(page >> kLevelBits) & kLevelMask].load(std::memory_order_acquire);
+		if (leaf == nullptr)
+		{
+			return nullptr;
+		}
+
+		const Region* region = leaf->regions[page & kLevelMask].load(std::memory_order_acquire);
+		if (region == nullptr || address < region->start_address || address >= region->end_address)
+		{
+			return nullptr;
+		}
+
+		return region;
+	}
+
+private:
+	struct Leaf
+	{
+		std::atomic<const Region*> regions[kLevelLength];
+	};
+
+	struct Interior
+	{
+		std::atomic<Leaf*> leaves[kLevelLength];
+	};
+
+	std::atomic<Interior*> root_[kLevelLength];
+	std::vector<Region*> free_regions_;
+	mem_size_t region_bump_address_;
+	mem_size_t region_bump_end_;
+	std::mutex mutex_;
+
+	PageMap();
+	~PageMap();
+
+	void Set(const mem_size_t& page, const Region* region);
+
+	PageMap(const PageMap& _page_map) = delete;
+	PageMap(PageMap&& _page_map) = delete;
+};
\ No newline at end of file
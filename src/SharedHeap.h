@@ -0,0 +1,67 @@
+#pragma once
+#include "Define.h"
+#include "ExplicitFreeListAllocator.h"
+#include "VirtualMemory.h"
+
+// Explicit free list heap in a named shared memory segment, for zero-copy messaging between local processes.
+// Every attached process maps the segment wherever it likes and talks in offsets from the segment base.
+// Operations are serialized by a process-shared lock, a lock abandoned by a dead process triggers a free list rebuild.
+// Each allocation records its owning process, allocations of dead processes are freed by ReclaimDeadProcesses.
+class SharedHeap
+{
+public:
+	static constexpr mem_size_t kNullOffset = 0;
+	// how long an attaching process waits for the creator to format the segment
+	static constexpr mem_size_t kAttachTimeoutMilliseconds = 5000;
+
+	// Throws std::runtime_error when the segment can't be mapped, or when the creator didn't finish
+	// sizing and formatting it within kAttachTimeoutMilliseconds, e.g. because it died. Unlink such a segment and retry.
+	SharedHeap(const char* name, const mem_size_t& capacity);
+	~SharedHeap();
+
+	// Every operation takes the shared lock. If a process died holding it and left boundary tags
+	// Recover can't repair, the segment is marked corrupt and every operation throws std::runtime_error.
+
+	// returns kNullOffset when the heap is exhausted
+	mem_size_t Allocate(const mem_size_t& size);
+	void Free(const mem_size_t& offset);
+	// takes over ownership of an allocation handed over by another process
+	void Adopt(const mem_size_t& offset);
+	// frees every allocation owned by a process that no longer exists, returns the bytes reclaimed
+	mem_size_t ReclaimDeadProcesses();
+
+	void* ToPointer(const mem_size_t& offset);
+	mem_size_t ToOffset(void* ptr);
+
+	// entry point shared by every attached process
+	mem_size_t GetRoot();
+	void SetRoot(const mem_size_t& offset);
+
+	// removes the segment name, live mappings stay valid
+	static void Unlink(const char* name);
+
+private:
+	struct SharedHeader;
+
+	// the start time tells a reused process id apart from the owner, 0 when the platform doesn't report it
+	struct AllocationHeader
+	{
+		uint64_t owner;
+		uint64_t owner_start_time;
+	};
+
+	VirtualMemory::MappedFile mapped_file_;
+	SharedHeader* shared_header_;
+	ExplicitFreeListAllocator* heap_;
+	mem_size_t segment_start_address_;
+	intptr_t lock_handle_;
+	uint64_t process_id_;
+	uint64_t process_start_time_;
+
+	void Lock();
+	void Unlock();
+	void Close();
+
+	SharedHeap(const SharedHeap& _heap) = delete;
+	SharedHeap(SharedHeap&& _heap) = delete;
+};
\ No newline at end of file
@@ -0,0 +1,97 @@
+#pragma once
+#include "Define.h"
+#include "PageMap.h"
+#include <ostream>
+#include <vector>
+
+// Segregated fixed-size blocks for small requests. Each chunk serves a single size class and
+// is registered in the page map with the class index, so Free needs no per-block header.
+// In adaptive mode a sampled size histogram is recorded during warm-up, then the classes are replaced
+// online by the ones that minimize internal fragmentation for the observed sizes.
+class SlabAllocator
+{
+public:
+	static constexpr mem_size_t kChunkSize = 64 KB;
+	// largest size served by the default power-of-two classes
+	static constexpr mem_size_t kMaxSlabSize = 256 BYTE;
+	// largest size adaptive or caller supplied classes may serve
+	static constexpr mem_size_t kMaxAdaptiveSize = 1 KB;
+	static constexpr mem_size_t kDefaultSizeSampleRate = 16;
+
+	SlabAllocator(const mem_size_t& capacity);
+	// classes from a table exported by DumpSizeClasses, block sizes ascending multiples of kAlignment
+	SlabAllocator(const mem_size_t& capacity, const mem_size_t* block_sizes, const mem_size_t& class_count);
+	~SlabAllocator();
+
+	// returns nullptr when size is above the largest class or the capacity is exhausted
+	void* Allocate(const mem_size_t& size);
+	void Free(void* ptr);
+	// region is ptr's page map entry, lets a composite allocator that already looked it up skip a second lookup
+	void Free(void* ptr, const Region* region);
+
+	bool Owns(void* ptr);
+
+	// samples roughly one allocation in kDefaultSizeSampleRate up to kMaxAdaptiveSize, after warmup_samples
+	// samples switches to at most class_count classes derived from the histogram
+	void EnableAdaptiveClasses(const mem_size_t& warmup_samples, const mem_size_t& class_count);
+	// current classes, expected and achieved waste and the classes as a constexpr table for a rebuild
+	void DumpSizeClasses(std::ostream& out);
+	mem_size_t GetMaxBlockSize();
+	mem_size_t GetMappedSize();
+
+private:
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	struct SizeClass
+	{
+		mem_size_t block_size;
+		FreeBlock* free_list;
+		mem_size_t bump_address;
+		mem_size_t bump_end;
+	};
+
+	// sampled requests whose size rounds up to the same kAlignment multiple
+	struct SizeBin
+	{
+		mem_size_t count;
+		mem_size_t bytes;
+	};
+
+	std::vector<SizeClass> size_classes_;
+	std::vector<Region*> chunks_;
+	mem_size_t class_lookup_[(kMaxAdaptiveSize >> 4) + 1];
+	mem_size_t active_class_begin_;
+	// classes replaced by adaptive ones, ascending block size, their free blocks still serve new requests
+	std::vector<mem_size_t> retired_classes_;
+	mem_size_t max_block_size_;
+	mem_size_t capacity_;
+	mem_size_t mapped_size_;
+
+	// 0 while not sampling
+	mem_size_t allocations_until_sample_;
+	uint64_t random_state_;
+	std::vector<SizeBin> histogram_;
+	mem_size_t warmup_samples_;
+	mem_size_t class_count_;
+	double expected_waste_;
+	double previous_waste_;
+	mem_size_t achieved_requested_bytes_;
+	mem_size_t achieved_block_bytes_;
+
+	void SizeToClass(const mem_size_t& size, mem_size_t& class_index);
+	bool Refill(const mem_size_t& class_index);
+	// pops a free block of a retired class that fits, so memory freed before a switch isn't stranded
+	void* AllocateRetired(const mem_size_t& size, const mem_size_t& block_size);
+	// appends the classes and routes every new allocation to them, blocks of retired classes are still freed to them
+	// and reused through AllocateRetired
+	void ActivateClasses(const std::vector<mem_size_t>& block_sizes);
+	void SampleSize(const mem_size_t& size);
+	void DeriveClasses(std::vector<mem_size_t>& block_sizes, double& expected_waste);
+	double GetHistogramWaste(const std::vector<mem_size_t>& block_sizes);
+
+	SlabAllocator(const SlabAllocator& _allocator) = delete;
+	SlabAllocator(SlabAllocator&& _allocator) = delete;
+};
\ No newline at end of file
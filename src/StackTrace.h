@@ -0,0 +1,15 @@
+#pragma once
+#include "Define.h"
+#include <string>
+
+constexpr mem_size_t kMaxStackDepth = 32;
+
+struct StackTrace
+{
+	void* frames[kMaxStackDepth];
+	mem_size_t depth;
+};
+
+// captures the calling stack, innermost frame first, skipping the given number of frames
+void CaptureStackTrace(StackTrace& trace, const mem_size_t& skip);
+void SymbolizeFrame(void* frame, std::string& symbol);
\ No newline at end of file
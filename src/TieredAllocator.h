@@ -0,0 +1,71 @@
+#pragma once
+#include "Define.h"
+#include "PageMap.h"
+#include "SlabAllocator.h"
+#include "ExplicitFreeListAllocator.h"
+#include "GuardedPool.h"
+
+enum class Tier
+{
+	kSlab,
+	kExplicitFreeList,
+	kDirect,
+	kGuarded,
+	kCount
+};
+
+// Fallback chain: slab -> explicit free list -> direct mapped pages.
+// Requests are routed by size thresholds and fall through to the next tier when a tier is exhausted,
+// Free is routed through the page map, pointers unknown to the page map are rejected.
+// Destroying the allocator releases every tier, including direct mappings that were never freed.
+class TieredAllocator
+{
+public:
+	static constexpr mem_size_t kDefaultDirectThreshold = 1 MB;
+
+	TieredAllocator(const mem_size_t& slab_capacity, const mem_size_t& heap_capacity);
+	TieredAllocator(const mem_size_t& slab_capacity, const mem_size_t& heap_capacity, const mem_size_t& direct_threshold);
+	~TieredAllocator();
+
+	void* Allocate(const mem_size_t& size);
+	// zero-filled allocation, huge requests get fresh pages and are never cleared
+	void* AllocateZeroed(const mem_size_t& size);
+	void Free(void* ptr);
+
+	mem_size_t GetHitCount(const Tier& tier);
+	void ResetHitCounts();
+
+	// a sampled fraction of allocations up to a page is served from guard-page slots, nullptr disables it
+	void SetGuardedPool(GuardedPool* guarded_pool);
+
+	// derives the slab size classes from the sizes sampled during warm-up, see SlabAllocator
+	void EnableAdaptiveSizeClasses(const mem_size_t& warmup_samples, const mem_size_t& class_count);
+	void DumpSizeClasses(std::ostream& out);
+
+private:
+	// in front of the payload of a direct mapping, linked so the destructor can release them.
+	// The Region lives outside the mapping, lookups may still read it after the pages are unmapped.
+	struct DirectMapping
+	{
+		Region* region;
+		DirectMapping* prev;
+		DirectMapping* next;
+	};
+
+	static constexpr mem_size_t kDirectHeaderSize = (sizeof(DirectMapping) + kAlignment - 1) & ~(kAlignment - 1);
+
+	SlabAllocator slab_;
+	ExplicitFreeListAllocator heap_;
+	mem_size_t direct_threshold_;
+	GuardedPool* guarded_pool_;
+	// live direct mappings, released by the destructor
+	DirectMapping* direct_mappings_;
+	mem_size_t hit_counts_[static_cast<mem_size_t>(Tier::kCount)];
+
+	void* AllocateDirect(const mem_size_t& size);
+	void FreeDirect(void* ptr, const Region* region);
+	void Hit(const Tier& tier);
+
+	TieredAllocator(const TieredAllocator& _allocator) = delete;
+	TieredAllocator(TieredAllocator&& _allocator) = delete;
+};
\ No newline at end of file
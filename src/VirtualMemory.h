@@ -0,0 +1,35 @@
+#pragma once
+#include "Define.h"
+
+namespace VirtualMemory
+{
+	struct MappedFile
+	{
+		void* address;
+		mem_size_t size;
+		bool created;
+		intptr_t file;
+		intptr_t mapping;
+	};
+
+	// maps zero-filled, page aligned read/write memory, returns nullptr on failure
+	void* Map(const mem_size_t& size);
+	void Unmap(void* ptr, const mem_size_t& size);
+	// toggles read/write access of whole pages, inaccessible pages fault on any access
+	bool Protect(void* ptr, const mem_size_t& size, bool accessible);
+	// hands whole pages of an anonymous mapping back to the OS, they read back zero-filled on the next touch
+	void Purge(void* ptr, const mem_size_t& size);
+
+	// Maps a file shared and read/write. A missing or empty file is created zero-filled with the given size,
+	// otherwise the existing file is mapped whole and size is ignored.
+	bool MapFile(const char* path, const mem_size_t& size, MappedFile& mapped_file);
+	void FlushFile(MappedFile& mapped_file);
+	// flushes, unmaps and closes the file
+	void UnmapFile(MappedFile& mapped_file);
+
+	// Maps a named shared memory segment, creating it zero-filled with the given size if it doesn't exist yet.
+	// An existing segment its creator hasn't sized within timeout_milliseconds fails, e.g. the creator died.
+	// Unmap with UnmapFile, the segment lives on until UnlinkShared and every mapping is gone.
+	bool MapShared(const char* name, const mem_size_t& size, const mem_size_t& timeout_milliseconds, MappedFile& mapped_file);
+	void UnlinkShared(const char* name);
+}
\ No newline at end of file
@@ -13,6 +13,11 @@ void* CrtAllocator::Allocate(const mem_size_t& size)
 	return malloc(size);
 }
 
+void* CrtAllocator::AllocateZeroed(const mem_size_t& size)
+{
+	return calloc(1, size);
+}
+
 void CrtAllocator::Free(void* ptr)
 {
 	free(ptr);
@@ -1,10 +1,56 @@
 #include "ExplicitFreeListAllocator.h"
+#include "VirtualMemory.h"
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
 #include <algorithm>
+#include <atomic>
+#include <new>
+#include <stdexcept>
+#include <string>
 
 constexpr mem_size_t kMinSpanSize = sizeof(ExplicitFreeListAllocator::Span) + sizeof(ExplicitFreeListAllocator::BoundaryTag) + kAlignment;
 constexpr mem_size_t kFreeMask = 0x1;
+constexpr mem_size_t kSampledMask = 0x2;
+constexpr mem_size_t kMovableMask = 0x4;
+constexpr mem_size_t kFlagMask = kAlignment - 1;
+// payload bytes of a free span taken by its links, always dirty
+constexpr mem_size_t kSpanLinkSize = sizeof(ExplicitFreeListAllocator::Span) - sizeof(ExplicitFreeListAllocator::BoundaryTag);
+// work charged for visiting a span during compaction, roughly a cache line
+constexpr mem_size_t kCompactVisitCost = 64;
+// neighbourhood searched by AllocateNear, a few TLB entries worth of pages
+constexpr mem_size_t kNearWindowSize = 64 KB;
+
+constexpr mem_size_t kHeapHeaderSize = (sizeof(ExplicitFreeListAllocator::HeapHeader) + kAlignment - 1) & ~(kAlignment - 1);
+constexpr uint64_t kHeapMagic = 0x50414548454c4645ull;
+constexpr uint64_t kHeapVersion = 3;
+
+namespace
+{
+	// returns nullptr when the header describes a heap this build can attach as is
+	const char* CheckHeapHeader(const ExplicitFreeListAllocator::HeapHeader* header, const mem_size_t& capacity)
+	{
+		if (header->magic != kHeapMagic)
+		{
+			return "not a heap";
+		}
+
+		if (header->version != kHeapVersion)
+		{
+			return "unsupported heap version";
+		}
+
+		if (header->capacity != capacity)
+		{
+			return "heap capacity mismatch";
+		}
+
+		return nullptr;
+	}
+}
+
+constexpr ExplicitFreeListAllocator::Handle ExplicitFreeListAllocator::kInvalidHandle;
+constexpr mem_size_t ExplicitFreeListAllocator::kNullOffset;
 
 ExplicitFreeListAllocator::ExplicitFreeListAllocator(const mem_size_t& capacity) :
 	ExplicitFreeListAllocator(capacity,
@@ -24,71 +70,225 @@ ExplicitFreeListAllocator::ExplicitFreeListAllocator(const mem_size_t& capacity,
 													 const PlacementPolicy& placement_policy,
 													 const CoalescingPolicy& coalescing_policy)
 {
-	heap_ = malloc(capacity);
-	heap_start_address_ = reinterpret_cast<mem_size_t>(heap_);
-	heap_end_ = heap_start_address_ + capacity;
-	free_list_ = CreateSpan(heap_start_address_, capacity - (sizeof(BoundaryTag) << 1));
-	placement_policy_ = placement_policy;
-	coalescing_policy_ = coalescing_policy;
-	last_fit_ = free_list_;
+	// page aligned so that the heap owns every page it touches in the page map
+	heap_ = VirtualMemory::Map(capacity);
+	if (heap_ == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	backing_ = Backing::kAnonymous;
+	warm_start_ = false;
+	mapped_file_.address = nullptr;
+	Initialize(capacity, placement_policy, coalescing_policy);
+	Format(true);
+	last_fit_ = ToSpan(header_->free_list);
+}
+
+ExplicitFreeListAllocator::ExplicitFreeListAllocator(const char* path, const mem_size_t& capacity) :
+	ExplicitFreeListAllocator(path,
+							  capacity,
+							  PlacementPolicy::kFirstFit,
+							  CoalescingPolicy::kImmediate)
+{}
+
+ExplicitFreeListAllocator::ExplicitFreeListAllocator(const char* path,
+													 const mem_size_t& capacity,
+													 const PlacementPolicy& placement_policy,
+													 const CoalescingPolicy& coalescing_policy)
+{
+	if (!VirtualMemory::MapFile(path, capacity, mapped_file_))
+	{
+		throw std::runtime_error(std::string(path) + ": can't open or map the heap file");
+	}
+	heap_ = mapped_file_.address;
+	backing_ = Backing::kFile;
+	warm_start_ = !mapped_file_.created;
+
+	// an existing file is never reformatted, whatever it holds stays untouched
+	const char* error = nullptr;
+	if (warm_start_)
+	{
+		error = CheckHeapHeader(reinterpret_cast<HeapHeader*>(heap_), RoundUp(kPageSize, capacity));
+		if (error == nullptr && mapped_file_.size != RoundUp(kPageSize, capacity))
+		{
+			error = "heap capacity mismatch";
+		}
+	}
+	if (error != nullptr)
+	{
+		VirtualMemory::UnmapFile(mapped_file_);
+		throw std::runtime_error(std::string(path) + ": " + error);
+	}
+
+	Initialize(mapped_file_.size, placement_policy, coalescing_policy);
+
+	if (!warm_start_)
+	{
+		Format(true);
+	}
+	else if (header_->clean_shutdown == 0)
+	{
+		// the previous owner died mid-flight, the boundary tags are the source of truth
+		try
+		{
+			Recover();
+		}
+		catch (...)
+		{
+			// no destructor runs for a throwing constructor, undo Initialize and the mapping here
+			PageMap::Instance().Unregister(region_);
+			PageMap::Instance().DeleteRegion(region_);
+			VirtualMemory::UnmapFile(mapped_file_);
+			throw;
+		}
+	}
+
+	header_->clean_shutdown = 0;
+	last_fit_ = ToSpan(header_->free_list);
+}
+
+ExplicitFreeListAllocator::ExplicitFreeListAllocator(void* memory, const mem_size_t& capacity, bool format)
+{
+	assert(memory != nullptr);
+	assert((reinterpret_cast<mem_size_t>(memory) & (kPageSize - 1)) == 0);
+	heap_ = memory;
+	backing_ = Backing::kExternal;
+	mapped_file_.address = nullptr;
+	warm_start_ = !format;
+
+	const char* error = warm_start_ ? CheckHeapHeader(reinterpret_cast<HeapHeader*>(heap_), capacity) : nullptr;
+	if (error != nullptr)
+	{
+		throw std::runtime_error(error);
+	}
+
+	Initialize(capacity, PlacementPolicy::kFirstFit, CoalescingPolicy::kImmediate);
+
+	if (!warm_start_)
+	{
+		Format(false);
+	}
+
+	last_fit_ = ToSpan(header_->free_list);
 }
 
 ExplicitFreeListAllocator::~ExplicitFreeListAllocator()
 {
-	free(heap_);
+	PageMap::Instance().Unregister(region_);
+	PageMap::Instance().DeleteRegion(region_);
+
+	if (backing_ == Backing::kFile)
+	{
+		VirtualMemory::FlushFile(mapped_file_);
+		header_->clean_shutdown = 1;
+		VirtualMemory::UnmapFile(mapped_file_);
+	}
+	else if (backing_ == Backing::kAnonymous)
+	{
+		VirtualMemory::Unmap(heap_, heap_end_ - heap_start_address_);
+	}
+
 	heap_ = nullptr;
-	free_list_ = nullptr;
+	header_ = nullptr;
 	last_fit_ = nullptr;
 }
 
 void* ExplicitFreeListAllocator::Allocate(const mem_size_t& size)
+{
+	return AllocatePayload(size, Lifetime::kDefault, false);
+}
+
+void* ExplicitFreeListAllocator::Allocate(const mem_size_t& size, const Lifetime& lifetime)
+{
+	return AllocatePayload(size, lifetime, false);
+}
+
+void* ExplicitFreeListAllocator::AllocateNear(void* hint, const mem_size_t& size)
 {
 	assert(size > 0);
 
-	SpanPointer fit_span = nullptr;
+	if (hint == nullptr || !Owns(hint))
+	{
+		return Allocate(size);
+	}
 
-	mem_size_t aligned_size, padding;
+	mem_size_t hint_address = reinterpret_cast<mem_size_t>(hint) - sizeof(BoundaryTag);
+	assert(!IsFree(reinterpret_cast<SpanPointer>(hint_address)->tag));
 
-	Align(size, kAlignment, aligned_size, padding);
+	SpanPointer fit_span = nullptr;
+	bool from_top = false;
 
-	Find(aligned_size, fit_span);
+	mem_size_t aligned_size, padding, dirty_size;
 
-	assert(fit_span != nullptr);
+	Align(size, kAlignment, aligned_size, padding);
 
-	// remove fit_span
-	RemoveFromFreeList(fit_span);
+	FindNearFit(hint_address, aligned_size, fit_span, from_top);
 
-	// split the fit span if there is some extra space
-	mem_size_t extra_space = GetSize(fit_span->tag) - aligned_size;
-	if (extra_space > kMinSpanSize)
+	if (fit_span == nullptr)
 	{
-		SpanPointer left, right;
-		mem_size_t left_addr, right_addr;
-		Split(fit_span, aligned_size, extra_space - (sizeof(BoundaryTag) << 1), left, right, left_addr, right_addr);
-		fit_span = left;
-		InsertToFreeList(right_addr, right);
+		return Allocate(size);
 	}
 
+	CarveSpan(aligned_size, from_top, fit_span, dirty_size);
+
 	mem_size_t span_address = reinterpret_cast<mem_size_t>(fit_span);
-	SetFlag(span_address, fit_span, true);
+	void* ptr = reinterpret_cast<void*>(span_address + sizeof(BoundaryTag));
 
-	mem_size_t payload_start = span_address + sizeof(BoundaryTag);
+	if (profiler_ != nullptr && profiler_->ShouldSample(size))
+	{
+		SetSampled(span_address, fit_span, true);
+		profiler_->RecordAllocation(ptr, size);
+	}
+
+	return ptr;
+}
 
-	return reinterpret_cast<void*>(payload_start);
+void* ExplicitFreeListAllocator::AllocateZeroed(const mem_size_t& size)
+{
+	return AllocatePayload(size, Lifetime::kDefault, true);
 }
 
 void ExplicitFreeListAllocator::Free(void* ptr)
 {
 	assert(ptr != nullptr);
-	assert(Contains(reinterpret_cast<mem_size_t>(ptr)));
+	Free(ptr, PageMap::Instance().Lookup(reinterpret_cast<mem_size_t>(ptr)));
+}
+
+void ExplicitFreeListAllocator::Free(void* ptr, const Region* region)
+{
+	assert(ptr != nullptr);
 
 	mem_size_t address = reinterpret_cast<mem_size_t>(ptr);
+
+	if (region != nullptr && region->kind == HeapKind::kGuarded)
+	{
+		static_cast<GuardedPool*>(region->owner)->Free(ptr);
+		return;
+	}
+
+	// reject stray pointers and double frees instead of corrupting the free list
+	assert(region != nullptr && region->owner == this);
+	if (region == nullptr || region->owner != this)
+	{
+		return;
+	}
+
 	mem_size_t span_address = address - sizeof(BoundaryTag);
 
+	// interior pointers and spans that were already freed or merged away don't pass
+	assert(IsAllocatedSpan(span_address));
+	if (!IsAllocatedSpan(span_address))
+	{
+		return;
+	}
+
 	// put the span into the address-ordered position of free list
 	SpanPointer span = reinterpret_cast<SpanPointer>(span_address);
 
-	mem_size_t size = GetSize(span->tag);
+	if (IsSampled(span->tag) && profiler_ != nullptr)
+	{
+		profiler_->RecordFree(ptr);
+	}
 
 	SpanPointer merged_span = nullptr;
 	mem_size_t merged_span_address = 0;
@@ -96,6 +296,533 @@ void ExplicitFreeListAllocator::Free(void* ptr)
 	InsertToFreeList(merged_span_address, merged_span);
 }
 
+ExplicitFreeListAllocator::Handle ExplicitFreeListAllocator::AllocateMovable(const mem_size_t& size)
+{
+	assert(size > 0);
+
+	SpanPointer fit_span = nullptr;
+
+	mem_size_t aligned_size, padding;
+
+	// the owning handle is stored in front of the payload so the compactor can fix it up
+	Align(size + sizeof(Handle), kAlignment, aligned_size, padding);
+
+	mem_size_t dirty_size;
+	AllocateSpan(aligned_size, Lifetime::kDefault, fit_span, dirty_size);
+
+	if (fit_span == nullptr)
+	{
+		return kInvalidHandle;
+	}
+
+	Handle handle;
+	if (!free_handles_.empty())
+	{
+		handle = free_handles_.back();
+		free_handles_.pop_back();
+	}
+	else
+	{
+		handle = handles_.size();
+		handles_.emplace_back();
+	}
+
+	mem_size_t span_address = reinterpret_cast<mem_size_t>(fit_span);
+	SetMovable(span_address, fit_span, true);
+	*reinterpret_cast<Handle*>(span_address + sizeof(BoundaryTag)) = handle;
+
+	handles_[handle].span_address = span_address;
+	handles_[handle].pin_count = 0;
+
+	return handle;
+}
+
+void ExplicitFreeListAllocator::FreeMovable(const Handle& handle)
+{
+	assert(handle < handles_.size());
+	assert(handles_[handle].pin_count == 0);
+
+	HandleEntry& entry = handles_[handle];
+	assert(entry.span_address != 0);
+
+	SpanPointer span = reinterpret_cast<SpanPointer>(entry.span_address);
+	SetMovable(entry.span_address, span, false);
+	Free(reinterpret_cast<void*>(entry.span_address + sizeof(BoundaryTag)));
+
+	entry.span_address = 0;
+	free_handles_.emplace_back(handle);
+}
+
+void* ExplicitFreeListAllocator::Resolve(const Handle& handle)
+{
+	assert(handle < handles_.size());
+	assert(handles_[handle].span_address != 0);
+
+	return reinterpret_cast<void*>(handles_[handle].span_address + sizeof(BoundaryTag) + sizeof(Handle));
+}
+
+void ExplicitFreeListAllocator::Pin(const Handle& handle)
+{
+	assert(handle < handles_.size());
+	handles_[handle].pin_count++;
+}
+
+void ExplicitFreeListAllocator::Unpin(const Handle& handle)
+{
+	assert(handle < handles_.size());
+	assert(handles_[handle].pin_count > 0);
+	handles_[handle].pin_count--;
+}
+
+bool ExplicitFreeListAllocator::Compact(const mem_size_t& budget)
+{
+	mem_size_t work = 0;
+
+	while (work < budget)
+	{
+		if (compact_cursor_ >= heap_end_)
+		{
+			// a full pass is done, the next slice starts over from the bottom of the heap
+			compact_cursor_ = GetFirstSpanAddress();
+			return true;
+		}
+
+		SpanPointer span = reinterpret_cast<SpanPointer>(compact_cursor_);
+		mem_size_t size = GetSize(span->tag);
+		work += kCompactVisitCost;
+
+		if (!IsFree(span->tag))
+		{
+			compact_cursor_ += size + (sizeof(BoundaryTag) << 1);
+			continue;
+		}
+
+		SpanPointer right;
+		mem_size_t right_address, right_size;
+		FindRightSpan(compact_cursor_, size, right, right_address, right_size);
+
+		if (right == nullptr)
+		{
+			compact_cursor_ = heap_end_;
+			continue;
+		}
+
+		if (IsFree(right->tag) || !IsMovable(right->tag) || IsPinned(right_address))
+		{
+			compact_cursor_ = right_address + right_size + (sizeof(BoundaryTag) << 1);
+			continue;
+		}
+
+		// the free span is now right after the moved one, keep sliding from there
+		SlideLeft(span, right);
+		compact_cursor_ += right_size + (sizeof(BoundaryTag) << 1);
+		work += right_size;
+	}
+
+	return false;
+}
+
+void* ExplicitFreeListAllocator::GetRoot()
+{
+	return header_->root == kNullOffset ? nullptr : reinterpret_cast<void*>(heap_start_address_ + header_->root);
+}
+
+void ExplicitFreeListAllocator::SetRoot(void* ptr)
+{
+	assert(ptr == nullptr || Owns(ptr));
+	header_->root = ptr == nullptr ? kNullOffset : reinterpret_cast<mem_size_t>(ptr) - heap_start_address_;
+}
+
+bool ExplicitFreeListAllocator::IsWarmStart()
+{
+	return warm_start_;
+}
+
+void ExplicitFreeListAllocator::Flush()
+{
+	if (backing_ == Backing::kFile)
+	{
+		VirtualMemory::FlushFile(mapped_file_);
+	}
+}
+
+mem_size_t ExplicitFreeListAllocator::GetLargestFreeSpan()
+{
+	mem_size_t largest = 0;
+	SpanPointer cur = ToSpan(header_->free_list);
+
+	while (cur != nullptr)
+	{
+		largest = std::max(largest, GetSize(cur->tag));
+		cur = ToSpan(cur->next);
+	}
+
+	return largest;
+}
+
+mem_size_t ExplicitFreeListAllocator::GetFreeSize()
+{
+	mem_size_t free_size = 0;
+	SpanPointer cur = ToSpan(header_->free_list);
+
+	while (cur != nullptr)
+	{
+		free_size += GetSize(cur->tag);
+		cur = ToSpan(cur->next);
+	}
+
+	return free_size;
+}
+
+mem_size_t ExplicitFreeListAllocator::Purge()
+{
+	// file and shared pages would read back from their backing store instead of as zero
+	if (backing_ != Backing::kAnonymous)
+	{
+		return 0;
+	}
+
+	mem_size_t purged = 0;
+	SpanPointer cur = ToSpan(header_->free_list);
+
+	while (cur != nullptr)
+	{
+		mem_size_t payload_start = reinterpret_cast<mem_size_t>(cur) + sizeof(BoundaryTag);
+		mem_size_t payload_end = payload_start + GetSize(cur->tag);
+		mem_size_t dirty_end = payload_start + GetDirtySize(cur);
+		mem_size_t purge_start = RoundUp(kPageSize, payload_start + kSpanLinkSize);
+		mem_size_t purge_end = payload_end & ~(kPageSize - 1);
+
+		if (purge_start < purge_end && dirty_end > purge_start)
+		{
+			// the partial page past the purged range is cheaper to clear by hand
+			if (dirty_end > purge_end)
+			{
+				memset(reinterpret_cast<void*>(purge_end), 0, dirty_end - purge_end);
+			}
+
+			VirtualMemory::Purge(reinterpret_cast<void*>(purge_start), purge_end - purge_start);
+			SetDirtySize(cur, purge_start - payload_start);
+			purged += purge_end - purge_start;
+		}
+
+		cur = ToSpan(cur->next);
+	}
+
+	return purged;
+}
+
+void ExplicitFreeListAllocator::Initialize(const mem_size_t& capacity,
+										   const PlacementPolicy& placement_policy,
+										   const CoalescingPolicy& coalescing_policy)
+{
+	heap_start_address_ = reinterpret_cast<mem_size_t>(heap_);
+	heap_end_ = heap_start_address_ + capacity;
+	header_ = reinterpret_cast<HeapHeader*>(heap_);
+	region_ = PageMap::Instance().NewRegion();
+	region_->kind = HeapKind::kExplicitFreeList;
+	region_->owner = this;
+	region_->start_address = heap_start_address_;
+	region_->end_address = heap_end_;
+	region_->size_class = 0;
+	region_->mapped_size = 0;
+	PageMap::Instance().Register(region_);
+	placement_policy_ = placement_policy;
+	coalescing_policy_ = coalescing_policy;
+	last_fit_ = nullptr;
+	profiler_ = nullptr;
+	guarded_pool_ = nullptr;
+	compact_cursor_ = GetFirstSpanAddress();
+}
+
+void ExplicitFreeListAllocator::Format(bool zeroed)
+{
+	mem_size_t capacity = heap_end_ - heap_start_address_;
+	assert(capacity > kHeapHeaderSize + kMinSpanSize);
+
+	header_->version = kHeapVersion;
+	header_->capacity = capacity;
+	header_->free_list = kNullOffset;
+	header_->root = kNullOffset;
+	header_->clean_shutdown = 0;
+	header_->pending_start = kNullOffset;
+	header_->pending_end = kNullOffset;
+
+	mem_size_t first_span_address = GetFirstSpanAddress();
+	SpanPointer first_span = CreateSpan(first_span_address, capacity - kHeapHeaderSize - (sizeof(BoundaryTag) << 1));
+	SetDirtySize(first_span, zeroed ? 0 : GetSize(first_span->tag));
+	InsertToFreeList(first_span_address, first_span);
+
+	// last, so a heap whose formatting was cut short is never mistaken for a valid one
+	std::atomic_signal_fence(std::memory_order_seq_cst);
+	header_->magic = kHeapMagic;
+}
+
+void ExplicitFreeListAllocator::Recover()
+{
+	header_->free_list = kNullOffset;
+
+	// a split or merge was cut short, nothing in its range had been handed out or was still live
+	if (header_->pending_end != kNullOffset)
+	{
+		CreateSpan(heap_start_address_ + header_->pending_start, header_->pending_end - header_->pending_start - (sizeof(BoundaryTag) << 1));
+		header_->pending_start = kNullOffset;
+		header_->pending_end = kNullOffset;
+	}
+
+	SpanPointer last_free = nullptr;
+	mem_size_t last_free_address = 0;
+
+	mem_size_t address = GetFirstSpanAddress();
+	while (address < heap_end_)
+	{
+		SpanPointer span = reinterpret_cast<SpanPointer>(address);
+		mem_size_t size = GetSize(span->tag);
+
+		if (size > heap_end_ - address - (sizeof(BoundaryTag) << 1))
+		{
+			throw std::runtime_error("heap boundary tags are corrupt");
+		}
+
+		BoundaryTagPointer footer = reinterpret_cast<BoundaryTagPointer>(address + sizeof(BoundaryTag) + size);
+		if (footer->size_and_flag != span->tag.size_and_flag)
+		{
+			// flag updates write the header first, a size mismatch can't come from an interrupted one
+			if (GetSize(*footer) != size)
+			{
+				throw std::runtime_error("heap boundary tags are corrupt");
+			}
+			footer->size_and_flag = span->tag.size_and_flag;
+		}
+
+		mem_size_t next_address = address + size + (sizeof(BoundaryTag) << 1);
+
+		if (!IsFree(span->tag))
+		{
+			last_free = nullptr;
+		}
+		else if (last_free != nullptr)
+		{
+			// an undone range can sit next to free spans that were never merged with it
+			mem_size_t merged_size = next_address - last_free_address - (sizeof(BoundaryTag) << 1);
+			SetSizeAndFlag(last_free_address, last_free, merged_size, false);
+			SetDirtySize(last_free, merged_size);
+		}
+		else
+		{
+			span->prev = kNullOffset;
+			span->next = kNullOffset;
+			SetDirtySize(span, size);
+			InsertToFreeList(address, span);
+			last_free = span;
+			last_free_address = address;
+		}
+
+		address = next_address;
+	}
+}
+
+void ExplicitFreeListAllocator::ForEachAllocation(AllocationVisitor visitor, void* context)
+{
+	mem_size_t address = GetFirstSpanAddress();
+	while (address < heap_end_)
+	{
+		SpanPointer span = reinterpret_cast<SpanPointer>(address);
+		mem_size_t size = GetSize(span->tag);
+
+		if (!IsFree(span->tag))
+		{
+			visitor(reinterpret_cast<void*>(address + sizeof(BoundaryTag)), size, context);
+		}
+
+		address += size + (sizeof(BoundaryTag) << 1);
+	}
+}
+
+inline ExplicitFreeListAllocator::SpanPointer ExplicitFreeListAllocator::ToSpan(const mem_size_t& offset)
+{
+	return offset == kNullOffset ? nullptr : reinterpret_cast<SpanPointer>(heap_start_address_ + offset);
+}
+
+inline mem_size_t ExplicitFreeListAllocator::ToOffset(const SpanPointer& span)
+{
+	return span == nullptr ? kNullOffset : reinterpret_cast<mem_size_t>(span) - heap_start_address_;
+}
+
+inline mem_size_t ExplicitFreeListAllocator::GetFirstSpanAddress()
+{
+	return heap_start_address_ + kHeapHeaderSize;
+}
+
+void* ExplicitFreeListAllocator::AllocatePayload(const mem_size_t& size, const Lifetime& lifetime, bool zeroed)
+{
+	assert(size > 0);
+
+	if (guarded_pool_ != nullptr && guarded_pool_->ShouldSample())
+	{
+		void* guarded = guarded_pool_->Allocate(size);
+		if (guarded != nullptr)
+		{
+			if (zeroed)
+			{
+				memset(guarded, 0, size);
+			}
+			return guarded;
+		}
+	}
+
+	SpanPointer fit_span = nullptr;
+
+	mem_size_t aligned_size, padding, dirty_size;
+
+	Align(size, kAlignment, aligned_size, padding);
+
+	AllocateSpan(aligned_size, lifetime, fit_span, dirty_size);
+
+	// exhausted, let the caller fall back to another allocator
+	if (fit_span == nullptr)
+	{
+		return nullptr;
+	}
+
+	mem_size_t span_address = reinterpret_cast<mem_size_t>(fit_span);
+	mem_size_t payload_start = span_address + sizeof(BoundaryTag);
+	void* ptr = reinterpret_cast<void*>(payload_start);
+
+	if (zeroed)
+	{
+		memset(ptr, 0, std::min(dirty_size, size));
+	}
+
+	if (profiler_ != nullptr && profiler_->ShouldSample(size))
+	{
+		SetSampled(span_address, fit_span, true);
+		profiler_->RecordAllocation(ptr, size);
+	}
+
+	return ptr;
+}
+
+void ExplicitFreeListAllocator::AllocateSpan(const mem_size_t& aligned_size, const Lifetime& lifetime, SpanPointer& span, mem_size_t& dirty_size)
+{
+	span = nullptr;
+	dirty_size = 0;
+
+	if (lifetime == Lifetime::kLong)
+	{
+		FindLowestFit(aligned_size, span);
+	}
+	else if (lifetime == Lifetime::kShort)
+	{
+		FindHighestFit(aligned_size, span);
+	}
+	else
+	{
+		Find(aligned_size, span);
+	}
+
+	if (span == nullptr)
+	{
+		return;
+	}
+
+	CarveSpan(aligned_size, lifetime == Lifetime::kShort, span, dirty_size);
+}
+
+void ExplicitFreeListAllocator::CarveSpan(const mem_size_t& aligned_size, bool from_top, SpanPointer& span, mem_size_t& dirty_size)
+{
+	// remove fit_span
+	RemoveFromFreeList(span);
+
+	mem_size_t span_dirty_size = GetDirtySize(span);
+	mem_size_t fit_address = reinterpret_cast<mem_size_t>(span);
+	BeginTagUpdate(fit_address, fit_address + GetSize(span->tag) + (sizeof(BoundaryTag) << 1));
+
+	// split the fit span if there is some extra space
+	mem_size_t extra_space = GetSize(span->tag) - aligned_size;
+	if (extra_space > kMinSpanSize && from_top)
+	{
+		// the allocation takes the top end, the remainder stays next to whatever lies below
+		SpanPointer left, right;
+		mem_size_t left_addr, right_addr;
+		Split(span, extra_space - (sizeof(BoundaryTag) << 1), aligned_size, left, right, left_addr, right_addr);
+		span = right;
+
+		mem_size_t right_payload_offset = right_addr - left_addr;
+		SetDirtySize(left, span_dirty_size);
+		InsertToFreeList(left_addr, left);
+		span_dirty_size = std::max(kSpanLinkSize, span_dirty_size > right_payload_offset ? span_dirty_size - right_payload_offset : 0);
+	}
+	else if (extra_space > kMinSpanSize)
+	{
+		SpanPointer left, right;
+		mem_size_t left_addr, right_addr;
+		Split(span, aligned_size, extra_space - (sizeof(BoundaryTag) << 1), left, right, left_addr, right_addr);
+		span = left;
+
+		// the remainder keeps whatever clean tail lies past its own links
+		mem_size_t right_payload_offset = right_addr - left_addr;
+		SetDirtySize(right, span_dirty_size > right_payload_offset ? span_dirty_size - right_payload_offset : 0);
+		InsertToFreeList(right_addr, right);
+	}
+
+	mem_size_t span_address = reinterpret_cast<mem_size_t>(span);
+	dirty_size = std::min(span_dirty_size, GetSize(span->tag));
+	SetFlag(span_address, span, true);
+
+	// the stale links are the first payload bytes, clear them inside the journal so a caller that dies
+	// before writing its own header leaves zeros rather than free list offsets behind
+	span->prev = kNullOffset;
+	span->next = kNullOffset;
+	EndTagUpdate();
+}
+
+void ExplicitFreeListAllocator::BeginTagUpdate(const mem_size_t& start_address, const mem_size_t& end_address)
+{
+	header_->pending_start = start_address - heap_start_address_;
+	header_->pending_end = end_address - heap_start_address_;
+
+	// a process dying under a shared heap's lock must not leave tags rewritten ahead of the journal
+	std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+void ExplicitFreeListAllocator::EndTagUpdate()
+{
+	std::atomic_signal_fence(std::memory_order_seq_cst);
+	header_->pending_end = kNullOffset;
+	header_->pending_start = kNullOffset;
+}
+
+void ExplicitFreeListAllocator::SlideLeft(SpanPointer& free_span, SpanPointer& movable_span)
+{
+	mem_size_t free_address = reinterpret_cast<mem_size_t>(free_span);
+	mem_size_t free_size = GetSize(free_span->tag);
+	mem_size_t movable_address = reinterpret_cast<mem_size_t>(movable_span);
+	mem_size_t movable_size = GetSize(movable_span->tag);
+	Handle handle = *reinterpret_cast<Handle*>(movable_address + sizeof(BoundaryTag));
+
+	RemoveFromFreeList(free_span);
+	last_fit_ = ToSpan(header_->free_list);
+
+	// payloads overlap when the movable span is larger than the gap
+	memmove(reinterpret_cast<void*>(free_address + sizeof(BoundaryTag)),
+			reinterpret_cast<void*>(movable_address + sizeof(BoundaryTag)),
+			movable_size);
+
+	SpanPointer moved = reinterpret_cast<SpanPointer>(free_address);
+	SetSizeAndFlag(free_address, moved, movable_size, true);
+	SetMovable(free_address, moved, true);
+	handles_[handle].span_address = free_address;
+
+	mem_size_t gap_address = free_address + movable_size + (sizeof(BoundaryTag) << 1);
+	SpanPointer gap = CreateSpan(gap_address, free_size);
+
+	SpanPointer merged_span = nullptr;
+	mem_size_t merged_span_address = 0;
+	Coalesce(gap, merged_span, merged_span_address);
+	InsertToFreeList(merged_span_address, merged_span);
+}
+
 void ExplicitFreeListAllocator::Find(const mem_size_t& aligned_size, SpanPointer& found)
 {
 	if (placement_policy_ == PlacementPolicy::kFirstFit)
@@ -118,7 +845,7 @@ void ExplicitFreeListAllocator::Find(const mem_size_t& aligned_size, SpanPointer
 
 void ExplicitFreeListAllocator::FindFirstFit(const mem_size_t& aligned_size, SpanPointer& found)
 {
-	SpanPointer cur = free_list_;
+	SpanPointer cur = ToSpan(header_->free_list);
 
 	while (cur != nullptr)
 	{
@@ -127,7 +854,7 @@ void ExplicitFreeListAllocator::FindFirstFit(const mem_size_t& aligned_size, Spa
 			found = cur;
 			break;
 		}
-		cur = cur->next;
+		cur = ToSpan(cur->next);
 	}
 }
 
@@ -143,7 +870,7 @@ void ExplicitFreeListAllocator::FindNextFit(const mem_size_t& aligned_size, Span
 			last_fit_ = cur;
 			break;
 		}
-		cur = cur->next;
+		cur = ToSpan(cur->next);
 	}
 }
 
@@ -151,7 +878,7 @@ void ExplicitFreeListAllocator::FindBestFit(const mem_size_t& aligned_size, Span
 {
 	mem_size_t min_span = kMaxSize;
 	SpanPointer min_span_pointer = nullptr;
-	SpanPointer cur = free_list_;
+	SpanPointer cur = ToSpan(header_->free_list);
 
 	while (cur != nullptr)
 	{
@@ -164,33 +891,110 @@ void ExplicitFreeListAllocator::FindBestFit(const mem_size_t& aligned_size, Span
 				min_span_pointer = cur;
 			}
 		}
-		cur = cur->next;
+		cur = ToSpan(cur->next);
 	}
 
 	found = min_span_pointer;
 }
 
+void ExplicitFreeListAllocator::FindLowestFit(const mem_size_t& aligned_size, SpanPointer& found)
+{
+	SpanPointer cur = ToSpan(header_->free_list);
+
+	while (cur != nullptr)
+	{
+		if (GetSize(cur->tag) >= aligned_size && (found == nullptr || cur < found))
+		{
+			found = cur;
+		}
+		cur = ToSpan(cur->next);
+	}
+}
+
+void ExplicitFreeListAllocator::FindHighestFit(const mem_size_t& aligned_size, SpanPointer& found)
+{
+	SpanPointer cur = ToSpan(header_->free_list);
+
+	while (cur != nullptr)
+	{
+		if (GetSize(cur->tag) >= aligned_size && (found == nullptr || cur > found))
+		{
+			found = cur;
+		}
+		cur = ToSpan(cur->next);
+	}
+}
+
+void ExplicitFreeListAllocator::FindNearFit(const mem_size_t& hint_address, const mem_size_t& aligned_size, SpanPointer& found, bool& from_top)
+{
+	// the boundary tags already order the heap by address, walk them outwards instead of keeping a separate index
+	mem_size_t window_base = hint_address & ~(kNearWindowSize - 1);
+	mem_size_t window_start = std::max(GetFirstSpanAddress(), window_base);
+	mem_size_t window_end = std::min(heap_end_, window_base + kNearWindowSize);
+	mem_size_t hint_end = hint_address + GetSize(reinterpret_cast<SpanPointer>(hint_address)->tag) + (sizeof(BoundaryTag) << 1);
+
+	SpanPointer right = nullptr;
+	mem_size_t address = hint_end;
+	while (address < window_end)
+	{
+		SpanPointer span = reinterpret_cast<SpanPointer>(address);
+		mem_size_t size = GetSize(span->tag);
+		if (IsFree(span->tag) && size >= aligned_size)
+		{
+			right = span;
+			break;
+		}
+		address += size + (sizeof(BoundaryTag) << 1);
+	}
+
+	SpanPointer left = nullptr;
+	mem_size_t left_end = hint_address;
+	address = hint_address;
+	while (address > window_start)
+	{
+		BoundaryTagPointer footer = reinterpret_cast<BoundaryTagPointer>(address - sizeof(BoundaryTag));
+		mem_size_t size = GetSize(*footer);
+		address -= size + (sizeof(BoundaryTag) << 1);
+
+		SpanPointer span = reinterpret_cast<SpanPointer>(address);
+		if (IsFree(span->tag) && size >= aligned_size)
+		{
+			left = span;
+			break;
+		}
+		left_end = address;
+	}
+
+	// take whichever end of the closer span faces the hint
+	mem_size_t right_gap = right != nullptr ? reinterpret_cast<mem_size_t>(right) - hint_end : kMaxSize;
+	mem_size_t left_gap = left != nullptr ? hint_address - left_end : kMaxSize;
+	from_top = left != nullptr && left_gap < right_gap;
+	found = from_top ? left : right;
+}
+
 void ExplicitFreeListAllocator::InsertToFreeList(const mem_size_t& address, SpanPointer& span)
 {
 	assert(span != nullptr);
-	assert(span->prev == nullptr);
+	assert(span->prev == kNullOffset);
 
 	SetFlag(address, span, false);
 
-	if (span == free_list_)
+	SpanPointer head = ToSpan(header_->free_list);
+
+	if (span == head)
 	{
 		return;
 	}
 
-	span->prev = nullptr;
-	span->next = free_list_;
+	span->prev = kNullOffset;
+	span->next = header_->free_list;
 
-	if (free_list_ != nullptr)
+	if (head != nullptr)
 	{
-		free_list_->prev = span;
+		head->prev = ToOffset(span);
 	}
 
-	free_list_ = span;
+	header_->free_list = ToOffset(span);
 }
 
 
@@ -198,35 +1002,35 @@ void ExplicitFreeListAllocator::RemoveFromFreeList(SpanPointer& span)
 {
 	if (span != nullptr)
 	{
-		SpanPointer prev = span->prev;
-		SpanPointer next = span->next;
+		SpanPointer prev = ToSpan(span->prev);
+		SpanPointer next = ToSpan(span->next);
 
-		span->prev = nullptr;
-		span->next = nullptr;
+		span->prev = kNullOffset;
+		span->next = kNullOffset;
 
 		if (prev != nullptr)
 		{
-			prev->next = next;
+			prev->next = ToOffset(next);
 		}
 
 		if (next != nullptr)
 		{
-			next->prev = prev;
+			next->prev = ToOffset(prev);
 		}
 
-		if (span == free_list_)
+		if (span == ToSpan(header_->free_list))
 		{
 			if (prev != nullptr)
 			{
-				free_list_ = prev;
+				header_->free_list = ToOffset(prev);
 			}
 			else if (next != nullptr)
 			{
-				free_list_ = next;
+				header_->free_list = ToOffset(next);
 			}
 			else
 			{
-				free_list_ = nullptr;
+				header_->free_list = kNullOffset;
 			}
 		}
 	}
@@ -236,7 +1040,11 @@ void ExplicitFreeListAllocator::Coalesce(SpanPointer& span, SpanPointer& merged_
 {
 	mem_size_t cur_size = GetSize(span->tag);
 	mem_size_t cur_address = reinterpret_cast<mem_size_t>(span);
-	
+
+	// the links of a span that was in use hold payload bytes
+	span->prev = kNullOffset;
+	span->next = kNullOffset;
+
 	SpanPointer left, right;
 	mem_size_t left_size, right_size;
 	mem_size_t left_address, right_address;
@@ -246,6 +1054,13 @@ void ExplicitFreeListAllocator::Coalesce(SpanPointer& span, SpanPointer& merged_
 	bool has_left_span = left != nullptr;
 	bool has_right_span = right != nullptr;
 
+	// the freed payload is dirty, only the clean tail of a free right neighbour survives the merge
+	mem_size_t dirty_end = cur_address + sizeof(BoundaryTag) + cur_size;
+	if (has_right_span && IsFree(right->tag))
+	{
+		dirty_end = right_address + sizeof(BoundaryTag) + GetDirtySize(right);
+	}
+
 	mem_size_t merged_size = cur_size;
 	merged_span = span;
 	merged_span_address = cur_address;
@@ -255,6 +1070,7 @@ void ExplicitFreeListAllocator::Coalesce(SpanPointer& span, SpanPointer& merged_
 		IsFree(left->tag) && 
 		IsFree(right->tag))
 	{
+		RemoveFromFreeList(left);
 		RemoveFromFreeList(right);
 		merged_span = left;
 		merged_size = left_size + cur_size + GetSize(right->tag) + (sizeof(BoundaryTag) << 2);
@@ -263,6 +1079,7 @@ void ExplicitFreeListAllocator::Coalesce(SpanPointer& span, SpanPointer& merged_
 	}
 	else if (has_left_span && IsFree(left->tag))
 	{
+		RemoveFromFreeList(left);
 		merged_span = left;
 		merged_size = left_size + cur_size + (sizeof(BoundaryTag) << 1);
 		merged_span_address = left_address;
@@ -279,7 +1096,20 @@ void ExplicitFreeListAllocator::Coalesce(SpanPointer& span, SpanPointer& merged_
 
 	if (merged_span != nullptr)
 	{
+		BeginTagUpdate(merged_span_address, merged_span_address + merged_size + (sizeof(BoundaryTag) << 1));
+
+		// tags swallowed by a merge must not look allocated to a later double free
+		SetFlag(cur_address, span, false);
 		SetSizeAndFlag(merged_span_address, merged_span, merged_size, false);
+		SetDirtySize(merged_span, dirty_end - merged_span_address - sizeof(BoundaryTag));
+
+		EndTagUpdate();
+	}
+
+	// keep the compactor's cursor on a span boundary
+	if (compact_cursor_ > merged_span_address && compact_cursor_ < merged_span_address + merged_size + (sizeof(BoundaryTag) << 1))
+	{
+		compact_cursor_ = merged_span_address;
 	}
 }
 
@@ -302,8 +1132,8 @@ void ExplicitFreeListAllocator::Split(SpanPointer& span,
 ExplicitFreeListAllocator::SpanPointer ExplicitFreeListAllocator::CreateSpan(const mem_size_t& address, const mem_size_t& size)
 {
 	SpanPointer new_span = reinterpret_cast<SpanPointer>(address);
-	new_span->prev = nullptr;
-	new_span->next = nullptr;
+	new_span->prev = kNullOffset;
+	new_span->next = kNullOffset;
 	SetSizeAndFlag(address, new_span, size, false);
 	return new_span;
 }
@@ -379,14 +1209,61 @@ inline bool ExplicitFreeListAllocator::IsFree(const BoundaryTag& tag)
 	return (tag.size_and_flag & kFreeMask) == 0;
 }
 
+inline bool ExplicitFreeListAllocator::IsSampled(const BoundaryTag& tag)
+{
+	return (tag.size_and_flag & kSampledMask) != 0;
+}
+
+inline bool ExplicitFreeListAllocator::IsMovable(const BoundaryTag& tag)
+{
+	return (tag.size_and_flag & kMovableMask) != 0;
+}
+
+inline void ExplicitFreeListAllocator::SetMovable(const mem_size_t& address, SpanPointer& span, bool movable)
+{
+	span->tag.size_and_flag = (movable ? kMovableMask : 0x0) | (span->tag.size_and_flag & ~kMovableMask);
+	SyncFooter(address, GetSize(span->tag), span->tag);
+}
+
+inline bool ExplicitFreeListAllocator::IsPinned(const mem_size_t& span_address)
+{
+	// handles don't persist, spans left movable by a previous process are never moved
+	Handle handle = *reinterpret_cast<Handle*>(span_address + sizeof(BoundaryTag));
+	return handle >= handles_.size() || 
+		   handles_[handle].span_address != span_address || 
+		   handles_[handle].pin_count != 0;
+}
+
+inline mem_size_t ExplicitFreeListAllocator::GetDirtySize(const SpanPointer& span)
+{
+	// spans too small to hold the watermark are dirty as a whole
+	mem_size_t size = GetSize(span->tag);
+	return size < kSpanLinkSize ? size : span->dirty_size;
+}
+
+inline void ExplicitFreeListAllocator::SetDirtySize(SpanPointer& span, const mem_size_t& dirty_size)
+{
+	mem_size_t size = GetSize(span->tag);
+	if (size >= kSpanLinkSize)
+	{
+		span->dirty_size = std::min(size, std::max(dirty_size, kSpanLinkSize));
+	}
+}
+
+inline void ExplicitFreeListAllocator::SetSampled(const mem_size_t& address, SpanPointer& span, bool sampled)
+{
+	span->tag.size_and_flag = (sampled ? kSampledMask : 0x0) | (span->tag.size_and_flag & ~kSampledMask);
+	SyncFooter(address, GetSize(span->tag), span->tag);
+}
+
 inline mem_size_t ExplicitFreeListAllocator::GetSize(const BoundaryTag& tag)
 {
-	return tag.size_and_flag & ~kFreeMask;
+	return tag.size_and_flag & ~kFlagMask;
 }
 
 inline void ExplicitFreeListAllocator::SetSize(BoundaryTag& tag, const mem_size_t& size)
 {
-	tag.size_and_flag = (size & ~kFreeMask) | (tag.size_and_flag & kFreeMask);
+	tag.size_and_flag = (size & ~kFlagMask) | (tag.size_and_flag & kFlagMask);
 }
 
 inline void ExplicitFreeListAllocator::SetFlag(BoundaryTag& tag, bool allocated)
@@ -396,7 +1273,7 @@ inline void ExplicitFreeListAllocator::SetFlag(BoundaryTag& tag, bool allocated)
 
 inline void ExplicitFreeListAllocator::SetSizeAndFlag(BoundaryTag& tag, const mem_size_t& size, bool allocated)
 {
-	tag.size_and_flag = (allocated ? 0x1 : 0x0) | (size & ~kFreeMask);
+	tag.size_and_flag = (allocated ? 0x1 : 0x0) | (size & ~kFlagMask);
 }
 
 inline void ExplicitFreeListAllocator::SyncFooter(const mem_size_t& address, const mem_size_t& size, const BoundaryTag& tag)
@@ -408,7 +1285,45 @@ inline void ExplicitFreeListAllocator::SyncFooter(const mem_size_t& address, con
 
 inline bool ExplicitFreeListAllocator::Contains(const mem_size_t& address)
 {
-	return address >= heap_start_address_ && address <= heap_end_;
+	return address >= heap_start_address_ + kHeapHeaderSize && address < heap_end_;
+}
+
+void ExplicitFreeListAllocator::SetProfiler(HeapProfiler* profiler)
+{
+	profiler_ = profiler;
+}
+
+void ExplicitFreeListAllocator::SetGuardedPool(GuardedPool* guarded_pool)
+{
+	guarded_pool_ = guarded_pool;
+}
+
+bool ExplicitFreeListAllocator::Owns(void* ptr)
+{
+	mem_size_t address = reinterpret_cast<mem_size_t>(ptr);
+	const Region* region = PageMap::Instance().Lookup(address);
+	return region != nullptr && region->owner == this && IsAllocatedSpan(address - sizeof(BoundaryTag));
+}
+
+bool ExplicitFreeListAllocator::IsAllocatedSpan(const mem_size_t& span_address)
+{
+	// spans start kAlignment aligned, a real one has matching header and footer tags
+	if ((span_address & (kAlignment - 1)) != 0 || 
+		span_address < GetFirstSpanAddress() || 
+		span_address + (sizeof(BoundaryTag) << 1) > heap_end_)
+	{
+		return false;
+	}
+
+	SpanPointer span = reinterpret_cast<SpanPointer>(span_address);
+	mem_size_t size = GetSize(span->tag);
+	if (IsFree(span->tag) || size == 0 || size > heap_end_ - span_address - (sizeof(BoundaryTag) << 1))
+	{
+		return false;
+	}
+
+	BoundaryTagPointer footer = reinterpret_cast<BoundaryTagPointer>(span_address + sizeof(BoundaryTag) + size);
+	return footer->size_and_flag == span->tag.size_and_flag;
 }
 
 inline void ExplicitFreeListAllocator::Align(const mem_size_t& size, const mem_size_t& alignment, mem_size_t& aligned_size, mem_size_t& padding)
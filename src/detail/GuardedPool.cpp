@@ -0,0 +1,397 @@
+#include "GuardedPool.h"
+#include "VirtualMemory.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string>
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+constexpr mem_size_t GuardedPool::kDefaultSlotCount;
+constexpr mem_size_t GuardedPool::kDefaultSampleRate;
+constexpr mem_size_t GuardedPool::kMaxGuardedSize;
+
+// frames of Allocate/Free and the allocator entry point
+constexpr mem_size_t kGuardedPoolSkipFrames = 2;
+// a report with two full raw stacks fits comfortably, longer symbolized reports are truncated
+constexpr mem_size_t kReportBufferSize = 4 KB;
+
+namespace
+{
+	// returns false when address isn't inside any guarded pool
+	bool ReportGuardedFault(const mem_size_t& address)
+	{
+		const Region* region = PageMap::Instance().Lookup(address);
+		if (region != nullptr && region->kind == HeapKind::kGuarded)
+		{
+			return static_cast<GuardedPool*>(region->owner)->ReportFault(address);
+		}
+		return false;
+	}
+
+#ifdef _WIN32
+	LONG CALLBACK GuardedPoolExceptionHandler(PEXCEPTION_POINTERS exception)
+	{
+		if (exception->ExceptionRecord->ExceptionCode == EXCEPTION_ACCESS_VIOLATION)
+		{
+			ReportGuardedFault(static_cast<mem_size_t>(exception->ExceptionRecord->ExceptionInformation[1]));
+		}
+		return EXCEPTION_CONTINUE_SEARCH;
+	}
+
+	void InstallFaultHandler()
+	{
+		AddVectoredExceptionHandler(1, GuardedPoolExceptionHandler);
+	}
+#else
+	struct sigaction previous_segv_action;
+
+	void GuardedPoolSignalHandler(int signal, siginfo_t* info, void* context)
+	{
+		if (ReportGuardedFault(reinterpret_cast<mem_size_t>(info->si_addr)))
+		{
+			// hand the fault back, the faulting instruction re-executes under the previous handler
+			sigaction(signal, &previous_segv_action, nullptr);
+			return;
+		}
+
+		// not a guarded fault, chain to the previous handler and stay installed in case it recovers
+		if ((previous_segv_action.sa_flags & SA_SIGINFO) != 0)
+		{
+			previous_segv_action.sa_sigaction(signal, info, context);
+		}
+		else if (previous_segv_action.sa_handler != SIG_DFL && previous_segv_action.sa_handler != SIG_IGN)
+		{
+			previous_segv_action.sa_handler(signal);
+		}
+		else
+		{
+			// the default action, restore it and let the fault repeat so the process dies as it would have
+			sigaction(signal, &previous_segv_action, nullptr);
+		}
+	}
+
+	void InstallFaultHandler()
+	{
+		struct sigaction action = {};
+		action.sa_sigaction = GuardedPoolSignalHandler;
+		action.sa_flags = SA_SIGINFO;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGSEGV, &action, &previous_segv_action);
+	}
+#endif
+
+	// Reports are formatted on the stack and written with a single write(2), since a fault report
+	// runs inside a signal handler where stdio, malloc and the symbolizer's locks are off limits.
+	struct ReportBuffer
+	{
+		char text[kReportBufferSize];
+		mem_size_t length;
+	};
+
+	void Append(ReportBuffer& buffer, const char* text)
+	{
+		while (*text != '\0' && buffer.length < kReportBufferSize)
+		{
+			buffer.text[buffer.length++] = *text++;
+		}
+	}
+
+	void AppendDecimal(ReportBuffer& buffer, mem_size_t value)
+	{
+		char digits[24];
+		mem_size_t count = 0;
+		do
+		{
+			digits[count++] = static_cast<char>('0' + value % 10);
+			value /= 10;
+		} while (value != 0);
+
+		while (count > 0 && buffer.length < kReportBufferSize)
+		{
+			buffer.text[buffer.length++] = digits[--count];
+		}
+	}
+
+	void AppendHex(ReportBuffer& buffer, mem_size_t value)
+	{
+		char digits[24];
+		mem_size_t count = 0;
+		do
+		{
+			digits[count++] = "0123456789abcdef"[value & 0xf];
+			value >>= 4;
+		} while (value != 0);
+
+		Append(buffer, "0x");
+		while (count > 0 && buffer.length < kReportBufferSize)
+		{
+			buffer.text[buffer.length++] = digits[--count];
+		}
+	}
+
+	void WriteReport(const ReportBuffer& buffer)
+	{
+		mem_size_t written = 0;
+		while (written < buffer.length)
+		{
+#ifdef _WIN32
+			int result = _write(2, buffer.text + written, static_cast<unsigned int>(buffer.length - written));
+#else
+			ssize_t result = write(STDERR_FILENO, buffer.text + written, buffer.length - written);
+#endif
+			if (result <= 0)
+			{
+				return;
+			}
+			written += static_cast<mem_size_t>(result);
+		}
+	}
+
+	void AppendStack(ReportBuffer& buffer, const char* title, const StackTrace& stack, bool symbolize)
+	{
+		Append(buffer, title);
+		Append(buffer, ":\n");
+
+		std::string symbol;
+		for (mem_size_t i = 0; i < stack.depth; i++)
+		{
+			Append(buffer, "    #");
+			AppendDecimal(buffer, i);
+			Append(buffer, " ");
+			if (symbolize)
+			{
+				SymbolizeFrame(stack.frames[i], symbol);
+				Append(buffer, symbol.c_str());
+			}
+			else
+			{
+				AppendHex(buffer, reinterpret_cast<mem_size_t>(stack.frames[i]));
+			}
+			Append(buffer, "\n");
+		}
+	}
+}
+
+GuardedPool::GuardedPool() :
+	GuardedPool(kDefaultSlotCount, kDefaultSampleRate)
+{}
+
+GuardedPool::GuardedPool(const mem_size_t& slot_count, const mem_size_t& sample_rate)
+{
+	assert(slot_count > 0 && sample_rate > 0);
+
+	static std::once_flag fault_handler_installed;
+	std::call_once(fault_handler_installed, InstallFaultHandler);
+
+	sample_rate_ = sample_rate;
+	random_state_ = SeedRandom(this);
+	allocations_until_sample_.store(static_cast<int64_t>(NextSampleDistance(random_state_, sample_rate_)), std::memory_order_relaxed);
+
+	// guard | slot | guard | slot | ... | guard
+	mem_size_t pool_size = ((slot_count << 1) + 1) * kPageSize;
+	pool_ = VirtualMemory::Map(pool_size);
+	assert(pool_ != nullptr);
+	VirtualMemory::Protect(pool_, pool_size, false);
+	pool_start_address_ = reinterpret_cast<mem_size_t>(pool_);
+	pool_end_ = pool_start_address_ + pool_size;
+
+	slots_.resize(slot_count);
+	for (mem_size_t i = 0; i < slot_count; i++)
+	{
+		slots_[i].state = SlotState::kUnused;
+		slots_[i].address = 0;
+		slots_[i].size = 0;
+		slots_[i].allocation_stack.depth = 0;
+		slots_[i].free_stack.depth = 0;
+		free_slots_.emplace_back(i);
+	}
+
+	region_ = PageMap::Instance().NewRegion();
+	region_->kind = HeapKind::kGuarded;
+	region_->owner = this;
+	region_->start_address = pool_start_address_;
+	region_->end_address = pool_end_;
+	region_->size_class = 0;
+	region_->mapped_size = 0;
+	PageMap::Instance().Register(region_);
+}
+
+GuardedPool::~GuardedPool()
+{
+	PageMap::Instance().Unregister(region_);
+	PageMap::Instance().DeleteRegion(region_);
+	VirtualMemory::Unmap(pool_, pool_end_ - pool_start_address_);
+	pool_ = nullptr;
+}
+
+void* GuardedPool::Allocate(const mem_size_t& size)
+{
+	assert(size > 0);
+
+	if (size > kMaxGuardedSize)
+	{
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (free_slots_.empty())
+	{
+		return nullptr;
+	}
+
+	// the least recently freed slot, so a dangling pointer keeps faulting as long as possible
+	mem_size_t slot_index = free_slots_.front();
+	free_slots_.pop_front();
+
+	Slot& slot = slots_[slot_index];
+	mem_size_t slot_address = GetSlotAddress(slot_index);
+	VirtualMemory::Protect(reinterpret_cast<void*>(slot_address), kPageSize, true);
+
+	slot.state = SlotState::kAllocated;
+	slot.address = slot_address + kPageSize - RoundUp(kAlignment, size);
+	slot.size = size;
+	slot.free_stack.depth = 0;
+	CaptureStackTrace(slot.allocation_stack, kGuardedPoolSkipFrames);
+
+	return reinterpret_cast<void*>(slot.address);
+}
+
+void GuardedPool::Free(void* ptr)
+{
+	mem_size_t address = reinterpret_cast<mem_size_t>(ptr);
+
+	assert(Owns(ptr));
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	mem_size_t page_index = (address - pool_start_address_) >> kPageShift;
+	Slot* slot = (page_index & 1) != 0 ? &slots_[page_index >> 1] : nullptr;
+
+	if (slot == nullptr || slot->state == SlotState::kUnused || slot->address != address)
+	{
+		Report("invalid free", address, slot, true);
+		abort();
+	}
+
+	if (slot->state == SlotState::kFreed)
+	{
+		Report("double free", address, slot, true);
+		abort();
+	}
+
+	slot->state = SlotState::kFreed;
+	CaptureStackTrace(slot->free_stack, kGuardedPoolSkipFrames);
+	VirtualMemory::Protect(reinterpret_cast<void*>(GetSlotAddress(page_index >> 1)), kPageSize, false);
+	free_slots_.emplace_back(page_index >> 1);
+}
+
+bool GuardedPool::Owns(void* ptr)
+{
+	mem_size_t address = reinterpret_cast<mem_size_t>(ptr);
+	return address >= pool_start_address_ && address < pool_end_;
+}
+
+bool GuardedPool::ReportFault(const mem_size_t& address)
+{
+	if (address < pool_start_address_ || address >= pool_end_)
+	{
+		return false;
+	}
+
+	mem_size_t page_index = (address - pool_start_address_) >> kPageShift;
+
+	if ((page_index & 1) != 0)
+	{
+		Slot* slot = &slots_[page_index >> 1];
+		Report(slot->state == SlotState::kFreed ? "use-after-free" : "access to unused slot", address, slot, false);
+		return true;
+	}
+
+	// a guard page, blame the closest allocation on either side
+	Slot* left = page_index > 0 ? &slots_[(page_index >> 1) - 1] : nullptr;
+	Slot* right = (page_index >> 1) < slots_.size() ? &slots_[page_index >> 1] : nullptr;
+
+	if (left != nullptr && left->state == SlotState::kUnused)
+	{
+		left = nullptr;
+	}
+
+	if (right != nullptr && right->state == SlotState::kUnused)
+	{
+		right = nullptr;
+	}
+
+	if (left != nullptr && (right == nullptr || address - (left->address + left->size) <= right->address - address))
+	{
+		Report(left->state == SlotState::kFreed ? "use-after-free" : "heap-buffer-overflow", address, left, false);
+	}
+	else if (right != nullptr)
+	{
+		Report(right->state == SlotState::kFreed ? "use-after-free" : "heap-buffer-underflow", address, right, false);
+	}
+	else
+	{
+		Report("access to guard page", address, nullptr, false);
+	}
+
+	return true;
+}
+
+void GuardedPool::RestartCountdown() noexcept
+{
+	// other threads keep counting down meanwhile, the countdown must end up positive or it never reaches 1 again
+	int64_t remaining = allocations_until_sample_.load(std::memory_order_relaxed);
+	int64_t distance = 0;
+	do
+	{
+		while (remaining + distance <= 0)
+		{
+			distance += static_cast<int64_t>(NextSampleDistance(random_state_, sample_rate_));
+		}
+	} while (!allocations_until_sample_.compare_exchange_weak(remaining, remaining + distance, std::memory_order_release, std::memory_order_relaxed));
+}
+
+inline mem_size_t GuardedPool::GetSlotAddress(const mem_size_t& slot_index)
+{
+	return pool_start_address_ + ((slot_index << 1) + 1) * kPageSize;
+}
+
+void GuardedPool::Report(const char* error, const mem_size_t& address, const Slot* slot, bool symbolize)
+{
+	ReportBuffer buffer;
+	buffer.length = 0;
+
+	Append(buffer, "===========================================================================\n");
+	Append(buffer, "GuardedPool: ");
+	Append(buffer, error);
+	Append(buffer, " at ");
+	AppendHex(buffer, address);
+	Append(buffer, "\n");
+
+	if (slot != nullptr && slot->state != SlotState::kUnused)
+	{
+		bool before = address < slot->address;
+		AppendDecimal(buffer, before ? slot->address - address : address - slot->address);
+		Append(buffer, before ? " bytes before allocation " : " bytes from the start of allocation ");
+		AppendHex(buffer, slot->address);
+		Append(buffer, " of size ");
+		AppendDecimal(buffer, slot->size);
+		Append(buffer, "\n");
+
+		AppendStack(buffer, "allocated at", slot->allocation_stack, symbolize);
+
+		if (slot->state == SlotState::kFreed)
+		{
+			AppendStack(buffer, "freed at", slot->free_stack, symbolize);
+		}
+	}
+
+	Append(buffer, "===========================================================================\n");
+	WriteReport(buffer);
+}
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "HeapProfiler.h"
+#include <assert.h>
+#include <math.h>
+
+constexpr mem_size_t HeapProfiler::kDefaultSamplingInterval;
+
+// frames of RecordAllocation and the allocator entry point
+constexpr mem_size_t kProfilerSkipFrames = 2;
+
+HeapProfiler::HeapProfiler() :
+	HeapProfiler(kDefaultSamplingInterval)
+{}
+
+HeapProfiler::HeapProfiler(const mem_size_t& sampling_interval)
+{
+	assert(sampling_interval > 0);
+	sampling_interval_ = sampling_interval;
+	random_state_ = SeedRandom(this);
+	bytes_until_sample_.store(static_cast<int64_t>(NextSampleDistance()), std::memory_order_relaxed);
+}
+
+HeapProfiler::~HeapProfiler()
+{}
+
+void HeapProfiler::RecordAllocation(void* ptr, const mem_size_t& size)
+{
+	Sample sample;
+	CaptureStackTrace(sample.stack, kProfilerSkipFrames);
+	sample.size = size;
+
+	// each sample stands for 1 / P(sampled) allocations of this size
+	sample.weight = 1.0 / (1.0 - exp(-static_cast<double>(size) / static_cast<double>(sampling_interval_)));
+
+	StackKey key(sample.stack.frames, sample.stack.frames + sample.stack.depth);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	live_samples_[ptr] = sample;
+	Totals& totals = cumulative_[key];
+	totals.count += sample.weight;
+	totals.bytes += sample.weight * static_cast<double>(size);
+}
+
+void HeapProfiler::RecordFree(void* ptr)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	live_samples_.erase(ptr);
+}
+
+void HeapProfiler::DumpLiveHeap(std::ostream& out)
+{
+	std::map<StackKey, Totals> profile;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (auto& pair : live_samples_)
+		{
+			const Sample& sample = pair.second;
+			StackKey key(sample.stack.frames, sample.stack.frames + sample.stack.depth);
+			Totals& totals = profile[key];
+			totals.count += sample.weight;
+			totals.bytes += sample.weight * static_cast<double>(sample.size);
+		}
+	}
+
+	Dump(profile, out);
+}
+
+void HeapProfiler::DumpAllocations(std::ostream& out)
+{
+	std::map<StackKey, Totals> profile;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		profile = cumulative_;
+	}
+
+	Dump(profile, out);
+}
+
+void HeapProfiler::RestartCountdown() noexcept
+{
+	// the countdown crossed zero inside this allocation, charge the remainder to the next interval.
+	// Other threads keep counting down meanwhile, the countdown must end up positive or it never crosses zero again.
+	int64_t remaining = bytes_until_sample_.load(std::memory_order_relaxed);
+	int64_t distance = 0;
+	do
+	{
+		while (remaining + distance <= 0)
+		{
+			distance += static_cast<int64_t>(NextSampleDistance());
+		}
+	} while (!bytes_until_sample_.compare_exchange_weak(remaining, remaining + distance, std::memory_order_release, std::memory_order_relaxed));
+}
+
+mem_size_t HeapProfiler::NextSampleDistance() noexcept
+{
+	// inverse transform to an exponential distribution with mean sampling_interval_
+	uint64_t bits = NextRandom(random_state_);
+
+	double uniform = (static_cast<double>(bits >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+	double distance = -log(uniform) * static_cast<double>(sampling_interval_);
+
+	return static_cast<mem_size_t>(distance) + 1;
+}
+
+void HeapProfiler::Dump(const std::map<StackKey, Totals>& profile, std::ostream& out)
+{
+	std::string symbol;
+	for (auto& pair : profile)
+	{
+		const StackKey& stack = pair.first;
+
+		// collapsed stacks are written root first
+		for (mem_size_t i = stack.size(); i > 0; i--)
+		{
+			SymbolizeFrame(stack[i - 1], symbol);
+			out << symbol;
+			if (i > 1)
+			{
+				out << ";";
+			}
+		}
+
+		out << " " << static_cast<uint64_t>(pair.second.bytes + 0.5) << "\n";
+	}
+}
\ No newline at end of file
@@ -0,0 +1,131 @@
+#include "PageMap.h"
+#include "VirtualMemory.h"
+#include <assert.h>
+#include <new>
+
+// regions are carved from blocks of this size, blocks are never unmapped
+constexpr mem_size_t kRegionBlockSize = 64 KB;
+
+PageMap& PageMap::Instance()
+{
+	static PageMap page_map;
+	return page_map;
+}
+
+PageMap::PageMap()
+{
+	for (mem_size_t i = 0; i < kLevelLength; i++)
+	{
+		root_[i].store(nullptr, std::memory_order_relaxed);
+	}
+	region_bump_address_ = 0;
+	region_bump_end_ = 0;
+}
+
+PageMap::~PageMap()
+{
+	// nodes are intentionally leaked, lock-free readers may still hold them during static destruction
+}
+
+Region* PageMap::NewRegion()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	if (!free_regions_.empty())
+	{
+		Region* region = free_regions_.back();
+		free_regions_.pop_back();
+		return region;
+	}
+
+	if (region_bump_address_ + sizeof(Region) > region_bump_end_)
+	{
+		void* block = VirtualMemory::Map(kRegionBlockSize);
+		assert(block != nullptr);
+		region_bump_address_ = reinterpret_cast<mem_size_t>(block);
+		region_bump_end_ = region_bump_address_ + kRegionBlockSize;
+	}
+
+	Region* region = new (reinterpret_cast<void*>(region_bump_address_)) Region();
+	region_bump_address_ += sizeof(Region);
+	return region;
+}
+
+void PageMap::DeleteRegion(Region* region)
+{
+	assert(region != nullptr);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	// empty bounds, a stale Lookup that still reaches it finds nothing
+	region->start_address = 0;
+	region->end_address = 0;
+	region->owner = nullptr;
+	free_regions_.emplace_back(region);
+}
+
+void PageMap::Register(const Region* region)
+{
+	assert(region != nullptr);
+	assert(region->start_address < region->end_address);
+	assert((region->end_address >> kAddressBits) == 0);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	mem_size_t first_page = region->start_address >> kPageShift;
+	mem_size_t last_page = (region->end_address - 1) >> kPageShift;
+	for (mem_size_t page = first_page; page <= last_page; page++)
+	{
+		Set(page, region);
+	}
+}
+
+void PageMap::Unregister(const Region* region)
+{
+	assert(region != nullptr);
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	mem_size_t first_page = region->start_address >> kPageShift;
+	mem_size_t last_page = (region->end_address - 1) >> kPageShift;
+	for (mem_size_t page = first_page; page <= last_page; page++)
+	{
+		Set(page, nullptr);
+	}
+}
+
+void PageMap::Set(const mem_size_t& page, const Region* region)
+{
+	std::atomic<Interior*>& interior_slot = root_[page >> (kLevelBits << 1)];
+	Interior* interior = interior_slot.load(std::memory_order_relaxed);
+	if (interior == nullptr)
+	{
+		if (region == nullptr)
+		{
+			return;
+		}
+
+		// fresh pages are zero-filled, which is a null atomic pointer
+		void* memory = VirtualMemory::Map(sizeof(Interior));
+		assert(memory != nullptr);
+		interior = new (memory) Interior();
+		interior_slot.store(interior, std::memory_order_release);
+	}
+
+	std::atomic<Leaf*>& leaf_slot = interior->leaves[(page >> kLevelBits) & kLevelMask];
+	Leaf* leaf = leaf_slot.load(std::memory_order_relaxed);
+	if (leaf == nullptr)
+	{
+		if (region == nullptr)
+		{
+			return;
+		}
+
+		void* memory = VirtualMemory::Map(sizeof(Leaf));
+		assert(memory != nullptr);
+		leaf = new (memory) Leaf();
+		leaf_slot.store(leaf, std::memory_order_release);
+	}
+
+	leaf->regions[page & kLevelMask].store(region, std::memory_order_release);
+}
\ No newline at end of file
@@ -0,0 +1,400 @@
+#include "SharedHeap.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+constexpr mem_size_t SharedHeap::kNullOffset;
+constexpr mem_size_t SharedHeap::kAttachTimeoutMilliseconds;
+
+constexpr uint64_t kSharedHeapMagic = 0x5048444552414853ull;
+
+// the shared header takes the first page, the heap starts page aligned right after it
+struct SharedHeap::SharedHeader
+{
+	uint64_t magic;
+	std::atomic<uint64_t> ready;
+	// set when a dead owner left tags Recover can't repair, every later locker fails fast
+	std::atomic<uint64_t> poisoned;
+#ifndef _WIN32
+	pthread_mutex_t lock;
+#endif
+};
+
+namespace
+{
+	uint64_t GetProcessId()
+	{
+#ifdef _WIN32
+		return static_cast<uint64_t>(GetCurrentProcessId());
+#else
+		return static_cast<uint64_t>(getpid());
+#endif
+	}
+
+#ifdef _WIN32
+	uint64_t GetProcessStartTime(HANDLE process)
+	{
+		FILETIME creation_time, exit_time, kernel_time, user_time;
+		if (!GetProcessTimes(process, &creation_time, &exit_time, &kernel_time, &user_time))
+		{
+			return 0;
+		}
+		return (static_cast<uint64_t>(creation_time.dwHighDateTime) << 32) | creation_time.dwLowDateTime;
+	}
+#endif
+
+	// returns 0 when unknown
+	uint64_t GetProcessStartTime(const uint64_t& process_id)
+	{
+#ifdef _WIN32
+		HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>(process_id));
+		if (process == nullptr)
+		{
+			return 0;
+		}
+
+		uint64_t start_time = GetProcessStartTime(process);
+		CloseHandle(process);
+		return start_time;
+#elif defined(__linux__)
+		// starttime is the 22nd field of /proc/<pid>/stat, the comm field before it may contain spaces and parentheses
+		char path[64];
+		snprintf(path, sizeof(path), "/proc/%llu/stat", static_cast<unsigned long long>(process_id));
+		FILE* file = fopen(path, "r");
+		if (file == nullptr)
+		{
+			return 0;
+		}
+
+		char stat[1024];
+		size_t length = fread(stat, 1, sizeof(stat) - 1, file);
+		fclose(file);
+		stat[length] = '\0';
+
+		char* field = strrchr(stat, ')');
+		if (field == nullptr)
+		{
+			return 0;
+		}
+
+		// fields 3 to 21 follow the comm field
+		for (int skipped = 0; skipped < 20 && field != nullptr; skipped++)
+		{
+			field = strchr(field + 1, ' ');
+		}
+
+		unsigned long long start_time = 0;
+		if (field == nullptr || sscanf(field + 1, "%llu", &start_time) != 1)
+		{
+			return 0;
+		}
+		return static_cast<uint64_t>(start_time);
+#else
+		(void)process_id;
+		return 0;
+#endif
+	}
+
+	// a process that exited and had its id reused has a different start time
+	bool IsProcessAlive(const uint64_t& process_id, const uint64_t& start_time)
+	{
+		// a carved block reads zero until Allocate stamps it under the lock, so a zero owner died in between
+		if (process_id == 0)
+		{
+			return false;
+		}
+
+#ifdef _WIN32
+		HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>(process_id));
+		if (process == nullptr)
+		{
+			return false;
+		}
+
+		DWORD exit_code = 0;
+		bool alive = GetExitCodeProcess(process, &exit_code) && exit_code == STILL_ACTIVE;
+		if (alive && start_time != 0)
+		{
+			alive = GetProcessStartTime(process) == start_time;
+		}
+		CloseHandle(process);
+		return alive;
+#else
+		if (kill(static_cast<pid_t>(process_id), 0) != 0 && errno != EPERM)
+		{
+			return false;
+		}
+		return start_time == 0 || GetProcessStartTime(process_id) == start_time;
+#endif
+	}
+
+	struct ReclaimContext
+	{
+		std::vector<void*> dead_allocations;
+		mem_size_t dead_bytes;
+	};
+}
+
+SharedHeap::SharedHeap(const char* name, const mem_size_t& capacity)
+{
+	process_id_ = GetProcessId();
+	process_start_time_ = GetProcessStartTime(process_id_);
+	heap_ = nullptr;
+
+	// one deadline for sizing and formatting, a creator that died before either never finishes it
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(kAttachTimeoutMilliseconds);
+
+	if (!VirtualMemory::MapShared(name, capacity + kPageSize, kAttachTimeoutMilliseconds, mapped_file_))
+	{
+		throw std::runtime_error(std::string(name) + ": can't open or map the shared segment, or it was never sized");
+	}
+
+	segment_start_address_ = reinterpret_cast<mem_size_t>(mapped_file_.address);
+	shared_header_ = reinterpret_cast<SharedHeader*>(mapped_file_.address);
+	void* heap_memory = reinterpret_cast<void*>(segment_start_address_ + kPageSize);
+	mem_size_t heap_capacity = mapped_file_.size - kPageSize;
+
+#ifdef _WIN32
+	std::string lock_name = std::string(name) + "_lock";
+	lock_handle_ = reinterpret_cast<intptr_t>(CreateMutexA(nullptr, FALSE, lock_name.c_str()));
+	if (lock_handle_ == 0)
+	{
+		VirtualMemory::UnmapFile(mapped_file_);
+		throw std::runtime_error(lock_name + ": can't create the shared lock");
+	}
+#else
+	lock_handle_ = 0;
+#endif
+
+	if (mapped_file_.created)
+	{
+		shared_header_ = new (mapped_file_.address) SharedHeader();
+		shared_header_->magic = kSharedHeapMagic;
+
+#ifndef _WIN32
+		// robust, so a process dying with the lock held doesn't wedge everyone else
+		pthread_mutexattr_t lock_attributes;
+		pthread_mutexattr_init(&lock_attributes);
+		pthread_mutexattr_setpshared(&lock_attributes, PTHREAD_PROCESS_SHARED);
+		pthread_mutexattr_setrobust(&lock_attributes, PTHREAD_MUTEX_ROBUST);
+		pthread_mutex_init(&shared_header_->lock, &lock_attributes);
+		pthread_mutexattr_destroy(&lock_attributes);
+#endif
+
+		heap_ = new ExplicitFreeListAllocator(heap_memory, heap_capacity, true);
+		shared_header_->ready.store(1, std::memory_order_release);
+	}
+	else
+	{
+		// wait for the creator to finish formatting
+		while (shared_header_->ready.load(std::memory_order_acquire) == 0)
+		{
+			if (std::chrono::steady_clock::now() > deadline)
+			{
+				Close();
+				throw std::runtime_error(std::string(name) + ": the shared segment was never formatted");
+			}
+#ifdef _WIN32
+			SwitchToThread();
+#else
+			sched_yield();
+#endif
+		}
+
+		try
+		{
+			if (shared_header_->magic != kSharedHeapMagic)
+			{
+				throw std::runtime_error(std::string(name) + ": not a shared heap");
+			}
+			heap_ = new ExplicitFreeListAllocator(heap_memory, heap_capacity, false);
+		}
+		catch (...)
+		{
+			Close();
+			throw;
+		}
+	}
+}
+
+SharedHeap::~SharedHeap()
+{
+	Close();
+}
+
+mem_size_t SharedHeap::Allocate(const mem_size_t& size)
+{
+	Lock();
+
+	void* ptr = heap_->Allocate(size + sizeof(AllocationHeader));
+	if (ptr == nullptr)
+	{
+		Unlock();
+		return kNullOffset;
+	}
+
+	// stamped under the lock, so ReclaimDeadProcesses never sees a stale owner
+	AllocationHeader* header = reinterpret_cast<AllocationHeader*>(ptr);
+	header->owner = process_id_;
+	header->owner_start_time = process_start_time_;
+
+	Unlock();
+
+	return reinterpret_cast<mem_size_t>(ptr) + sizeof(AllocationHeader) - segment_start_address_;
+}
+
+void SharedHeap::Free(const mem_size_t& offset)
+{
+	assert(offset != kNullOffset);
+
+	void* ptr = reinterpret_cast<void*>(segment_start_address_ + offset - sizeof(AllocationHeader));
+
+	Lock();
+	heap_->Free(ptr);
+	Unlock();
+}
+
+void SharedHeap::Adopt(const mem_size_t& offset)
+{
+	assert(offset != kNullOffset);
+
+	AllocationHeader* header = reinterpret_cast<AllocationHeader*>(segment_start_address_ + offset - sizeof(AllocationHeader));
+
+	// under the lock, ReclaimDeadProcesses must never see the owner change halfway
+	Lock();
+	header->owner = process_id_;
+	header->owner_start_time = process_start_time_;
+	Unlock();
+}
+
+mem_size_t SharedHeap::ReclaimDeadProcesses()
+{
+	ReclaimContext context;
+	context.dead_bytes = 0;
+
+	Lock();
+
+	heap_->ForEachAllocation([](void* ptr, const mem_size_t& size, void* context)
+	{
+		ReclaimContext* reclaim_context = reinterpret_cast<ReclaimContext*>(context);
+		AllocationHeader* header = reinterpret_cast<AllocationHeader*>(ptr);
+		if (!IsProcessAlive(header->owner, header->owner_start_time))
+		{
+			reclaim_context->dead_allocations.emplace_back(ptr);
+			reclaim_context->dead_bytes += size;
+		}
+	}, &context);
+
+	for (auto& ptr : context.dead_allocations)
+	{
+		heap_->Free(ptr);
+	}
+
+	Unlock();
+
+	return context.dead_bytes;
+}
+
+void* SharedHeap::ToPointer(const mem_size_t& offset)
+{
+	return offset == kNullOffset ? nullptr : reinterpret_cast<void*>(segment_start_address_ + offset);
+}
+
+mem_size_t SharedHeap::ToOffset(void* ptr)
+{
+	return ptr == nullptr ? kNullOffset : reinterpret_cast<mem_size_t>(ptr) - segment_start_address_;
+}
+
+mem_size_t SharedHeap::GetRoot()
+{
+	Lock();
+	mem_size_t root = ToOffset(heap_->GetRoot());
+	Unlock();
+
+	// the heap root points at the allocation header
+	return root == kNullOffset ? kNullOffset : root + sizeof(AllocationHeader);
+}
+
+void SharedHeap::SetRoot(const mem_size_t& offset)
+{
+	Lock();
+	heap_->SetRoot(offset == kNullOffset ? nullptr : reinterpret_cast<void*>(segment_start_address_ + offset - sizeof(AllocationHeader)));
+	Unlock();
+}
+
+void SharedHeap::Unlink(const char* name)
+{
+	VirtualMemory::UnlinkShared(name);
+}
+
+void SharedHeap::Lock()
+{
+#ifdef _WIN32
+	DWORD result = WaitForSingleObject(reinterpret_cast<HANDLE>(lock_handle_), INFINITE);
+	bool owner_died = result == WAIT_ABANDONED;
+#else
+	int result = pthread_mutex_lock(&shared_header_->lock);
+	bool owner_died = result == EOWNERDEAD;
+	if (owner_died)
+	{
+		pthread_mutex_consistent(&shared_header_->lock);
+	}
+#endif
+
+	if (owner_died && shared_header_->poisoned.load(std::memory_order_relaxed) == 0)
+	{
+		// the owner died inside the heap, trust the boundary tags over its half-updated free list
+		try
+		{
+			heap_->Recover();
+		}
+		catch (...)
+		{
+			shared_header_->poisoned.store(1, std::memory_order_relaxed);
+		}
+	}
+
+	// never leave the lock held on the way out, the other processes would block forever
+	if (shared_header_->poisoned.load(std::memory_order_relaxed) != 0)
+	{
+		Unlock();
+		throw std::runtime_error("shared heap is corrupt, a process died inside it");
+	}
+}
+
+void SharedHeap::Close()
+{
+	delete heap_;
+	heap_ = nullptr;
+
+	VirtualMemory::UnmapFile(mapped_file_);
+	shared_header_ = nullptr;
+
+#ifdef _WIN32
+	CloseHandle(reinterpret_cast<HANDLE>(lock_handle_));
+#endif
+}
+
+void SharedHeap::Unlock()
+{
+#ifdef _WIN32
+	ReleaseMutex(reinterpret_cast<HANDLE>(lock_handle_));
+#else
+	pthread_mutex_unlock(&shared_header_->lock);
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,431 @@
+#include "SlabAllocator.h"
+#include "VirtualMemory.h"
+#include <assert.h>
+#include <algorithm>
+
+constexpr mem_size_t SlabAllocator::kChunkSize;
+constexpr mem_size_t SlabAllocator::kMaxSlabSize;
+constexpr mem_size_t SlabAllocator::kMaxAdaptiveSize;
+constexpr mem_size_t SlabAllocator::kDefaultSizeSampleRate;
+
+// power-of-two classes from kAlignment up to kMaxSlabSize
+constexpr mem_size_t kDefaultBlockSizes[] = { 16, 32, 64, 128, 256 };
+
+// sizes above the largest class fall through to the explicit free list, which adds a header and a footer tag
+constexpr mem_size_t kFallbackTagSize = 2 * sizeof(mem_size_t);
+
+SlabAllocator::SlabAllocator(const mem_size_t& capacity) :
+	SlabAllocator(capacity,
+				  kDefaultBlockSizes,
+				  sizeof(kDefaultBlockSizes) / sizeof(kDefaultBlockSizes[0]))
+{}
+
+SlabAllocator::SlabAllocator(const mem_size_t& capacity, const mem_size_t* block_sizes, const mem_size_t& class_count)
+{
+	assert(block_sizes != nullptr && class_count > 0);
+
+	capacity_ = capacity;
+	mapped_size_ = 0;
+	allocations_until_sample_ = 0;
+	random_state_ = SeedRandom(this);
+	warmup_samples_ = 0;
+	class_count_ = 0;
+	expected_waste_ = -1.0;
+	previous_waste_ = -1.0;
+	achieved_requested_bytes_ = 0;
+	achieved_block_bytes_ = 0;
+
+	ActivateClasses(std::vector<mem_size_t>(block_sizes, block_sizes + class_count));
+}
+
+SlabAllocator::~SlabAllocator()
+{
+	for (auto& chunk : chunks_)
+	{
+		PageMap::Instance().Unregister(chunk);
+		VirtualMemory::Unmap(reinterpret_cast<void*>(chunk->start_address), kChunkSize);
+		PageMap::Instance().DeleteRegion(chunk);
+	}
+	chunks_.clear();
+}
+
+void* SlabAllocator::Allocate(const mem_size_t& size)
+{
+	assert(size > 0);
+
+	if (allocations_until_sample_ != 0 && --allocations_until_sample_ == 0)
+	{
+		SampleSize(size);
+	}
+
+	if (size > max_block_size_)
+	{
+		return nullptr;
+	}
+
+	mem_size_t class_index;
+	SizeToClass(size, class_index);
+	SizeClass& size_class = size_classes_[class_index];
+
+	if (size_class.free_list != nullptr)
+	{
+		FreeBlock* block = size_class.free_list;
+		size_class.free_list = block->next;
+		return block;
+	}
+
+	if (size_class.bump_address + size_class.block_size > size_class.bump_end)
+	{
+		void* retired = AllocateRetired(size, size_class.block_size);
+		if (retired != nullptr)
+		{
+			return retired;
+		}
+
+		if (!Refill(class_index))
+		{
+			return nullptr;
+		}
+	}
+
+	void* ptr = reinterpret_cast<void*>(size_class.bump_address);
+	size_class.bump_address += size_class.block_size;
+	return ptr;
+}
+
+void SlabAllocator::Free(void* ptr)
+{
+	assert(ptr != nullptr);
+	Free(ptr, PageMap::Instance().Lookup(reinterpret_cast<mem_size_t>(ptr)));
+}
+
+void SlabAllocator::Free(void* ptr, const Region* region)
+{
+	assert(region != nullptr && region->owner == this);
+	if (region == nullptr || region->owner != this)
+	{
+		return;
+	}
+
+	SizeClass& size_class = size_classes_[region->size_class];
+	FreeBlock* block = reinterpret_cast<FreeBlock*>(ptr);
+	block->next = size_class.free_list;
+	size_class.free_list = block;
+}
+
+bool SlabAllocator::Owns(void* ptr)
+{
+	const Region* region = PageMap::Instance().Lookup(reinterpret_cast<mem_size_t>(ptr));
+	return region != nullptr && region->owner == this;
+}
+
+void SlabAllocator::EnableAdaptiveClasses(const mem_size_t& warmup_samples, const mem_size_t& class_count)
+{
+	assert(warmup_samples > 0 && class_count > 0);
+
+	histogram_.assign(kMaxAdaptiveSize >> 4, SizeBin{ 0, 0 });
+	warmup_samples_ = warmup_samples;
+	class_count_ = class_count;
+	achieved_requested_bytes_ = 0;
+	achieved_block_bytes_ = 0;
+	allocations_until_sample_ = NextSampleDistance(random_state_, kDefaultSizeSampleRate);
+}
+
+void SlabAllocator::DumpSizeClasses(std::ostream& out)
+{
+	out << "Size Classes:";
+	for (mem_size_t i = active_class_begin_; i < size_classes_.size(); i++)
+	{
+		out << " " << size_classes_[i].block_size;
+	}
+	out << "\n";
+
+	if (expected_waste_ >= 0.0)
+	{
+		out << "Expected Waste: " << expected_waste_ * 100.0 << "% (previous classes: " << previous_waste_ * 100.0 << "%, sizes above their largest class at the heap's tag cost)\n";
+	}
+
+	if (achieved_block_bytes_ > 0)
+	{
+		out << "Achieved Waste: " << (double)(achieved_block_bytes_ - achieved_requested_bytes_) / (double)achieved_block_bytes_ * 100.0 << "%\n";
+	}
+
+	out << "constexpr mem_size_t kSlabSizeClasses[] = {";
+	for (mem_size_t i = active_class_begin_; i < size_classes_.size(); i++)
+	{
+		out << (i == active_class_begin_ ? " " : ", ") << size_classes_[i].block_size;
+	}
+	out << " };\n";
+}
+
+mem_size_t SlabAllocator::GetMaxBlockSize()
+{
+	return max_block_size_;
+}
+
+mem_size_t SlabAllocator::GetMappedSize()
+{
+	return mapped_size_;
+}
+
+inline void SlabAllocator::SizeToClass(const mem_size_t& size, mem_size_t& class_index)
+{
+	class_index = class_lookup_[(size + kAlignment - 1) >> 4];
+}
+
+bool SlabAllocator::Refill(const mem_size_t& class_index)
+{
+	if (mapped_size_ + kChunkSize > capacity_)
+	{
+		return false;
+	}
+
+	void* chunk = VirtualMemory::Map(kChunkSize);
+	if (chunk == nullptr)
+	{
+		return false;
+	}
+
+	Region* region = PageMap::Instance().NewRegion();
+	region->kind = HeapKind::kSlab;
+	region->owner = this;
+	region->start_address = reinterpret_cast<mem_size_t>(chunk);
+	region->end_address = region->start_address + kChunkSize;
+	region->size_class = class_index;
+	region->mapped_size = 0;
+	PageMap::Instance().Register(region);
+	chunks_.emplace_back(region);
+	mapped_size_ += kChunkSize;
+
+	SizeClass& size_class = size_classes_[class_index];
+	size_class.bump_address = region->start_address;
+	size_class.bump_end = region->end_address;
+
+	return true;
+}
+
+void* SlabAllocator::AllocateRetired(const mem_size_t& size, const mem_size_t& block_size)
+{
+	// up to twice the active block, beyond that a fresh chunk wastes less
+	for (auto& class_index : retired_classes_)
+	{
+		SizeClass& size_class = size_classes_[class_index];
+		if (size_class.block_size > (block_size << 1))
+		{
+			break;
+		}
+
+		if (size_class.block_size >= size && size_class.free_list != nullptr)
+		{
+			FreeBlock* block = size_class.free_list;
+			size_class.free_list = block->next;
+			return block;
+		}
+	}
+
+	return nullptr;
+}
+
+void SlabAllocator::ActivateClasses(const std::vector<mem_size_t>& block_sizes)
+{
+	assert(!block_sizes.empty());
+
+	active_class_begin_ = size_classes_.size();
+
+	retired_classes_.clear();
+	for (mem_size_t i = 0; i < active_class_begin_; i++)
+	{
+		retired_classes_.emplace_back(i);
+	}
+	std::sort(retired_classes_.begin(), retired_classes_.end(), [this](const mem_size_t& a, const mem_size_t& b)
+	{
+		return size_classes_[a].block_size < size_classes_[b].block_size;
+	});
+
+	for (auto& block_size : block_sizes)
+	{
+		assert((block_size & (kAlignment - 1)) == 0 && block_size <= kMaxAdaptiveSize);
+		assert(size_classes_.size() == active_class_begin_ || size_classes_.back().block_size < block_size);
+
+		SizeClass size_class;
+		size_class.block_size = block_size;
+		size_class.free_list = nullptr;
+		size_class.bump_address = 0;
+		size_class.bump_end = 0;
+		size_classes_.emplace_back(size_class);
+	}
+
+	max_block_size_ = block_sizes.back();
+
+	// class_lookup_[i] is the smallest active class whose block fits (i << 4) bytes
+	mem_size_t class_index = active_class_begin_;
+	for (mem_size_t i = 0; i <= (kMaxAdaptiveSize >> 4); i++)
+	{
+		while (class_index + 1 < size_classes_.size() && size_classes_[class_index].block_size < (i << 4))
+		{
+			class_index++;
+		}
+		class_lookup_[i] = class_index;
+	}
+}
+
+void SlabAllocator::SampleSize(const mem_size_t& size)
+{
+	allocations_until_sample_ = NextSampleDistance(random_state_, kDefaultSizeSampleRate);
+
+	if (size > kMaxAdaptiveSize)
+	{
+		return;
+	}
+
+	if (warmup_samples_ == 0)
+	{
+		achieved_requested_bytes_ += size;
+		if (size <= max_block_size_)
+		{
+			mem_size_t class_index;
+			SizeToClass(size, class_index);
+			achieved_block_bytes_ += size_classes_[class_index].block_size;
+		}
+		else
+		{
+			achieved_block_bytes_ += RoundUp(kAlignment, size) + kFallbackTagSize;
+		}
+		return;
+	}
+
+	SizeBin& bin = histogram_[((size + kAlignment - 1) >> 4) - 1];
+	bin.count++;
+	bin.bytes += size;
+
+	if (--warmup_samples_ == 0)
+	{
+		std::vector<mem_size_t> previous_block_sizes;
+		for (mem_size_t i = active_class_begin_; i < size_classes_.size(); i++)
+		{
+			previous_block_sizes.emplace_back(size_classes_[i].block_size);
+		}
+		previous_waste_ = GetHistogramWaste(previous_block_sizes);
+
+		std::vector<mem_size_t> block_sizes;
+		DeriveClasses(block_sizes, expected_waste_);
+		if (!block_sizes.empty())
+		{
+			ActivateClasses(block_sizes);
+		}
+	}
+}
+
+void SlabAllocator::DeriveClasses(std::vector<mem_size_t>& block_sizes, double& expected_waste)
+{
+	// Bins are candidate class boundaries, a class at bin i serves every bin after the previous class up to i.
+	// waste[k][i] is the least waste covering bins 0..i with k classes, the last one at bin i.
+	mem_size_t bin_count = histogram_.size();
+	std::vector<mem_size_t> count_sums(bin_count + 1, 0);
+	std::vector<mem_size_t> byte_sums(bin_count + 1, 0);
+	mem_size_t used_bins = 0;
+	mem_size_t top_bin = bin_count;
+
+	for (mem_size_t i = 0; i < bin_count; i++)
+	{
+		count_sums[i + 1] = count_sums[i] + histogram_[i].count;
+		byte_sums[i + 1] = byte_sums[i] + histogram_[i].bytes;
+		if (histogram_[i].count > 0)
+		{
+			used_bins++;
+			top_bin = i;
+		}
+	}
+
+	block_sizes.clear();
+	expected_waste = -1.0;
+
+	if (used_bins == 0)
+	{
+		return;
+	}
+
+	// only classes at used bins, a class over an empty bin never saves anything
+	mem_size_t class_count = std::min(class_count_, used_bins);
+	const mem_size_t kNoSolution = ~static_cast<mem_size_t>(0);
+	std::vector<std::vector<mem_size_t>> waste(class_count + 1, std::vector<mem_size_t>(bin_count, kNoSolution));
+	std::vector<std::vector<mem_size_t>> previous(class_count + 1, std::vector<mem_size_t>(bin_count, 0));
+
+	auto GetWaste = [&](const mem_size_t& first, const mem_size_t& last)
+	{
+		return (count_sums[last + 1] - count_sums[first]) * ((last + 1) << 4) - (byte_sums[last + 1] - byte_sums[first]);
+	};
+
+	for (mem_size_t i = 0; i < bin_count; i++)
+	{
+		if (histogram_[i].count > 0)
+		{
+			waste[1][i] = GetWaste(0, i);
+		}
+	}
+
+	for (mem_size_t k = 2; k <= class_count; k++)
+	{
+		for (mem_size_t i = 0; i < bin_count; i++)
+		{
+			if (histogram_[i].count == 0)
+			{
+				continue;
+			}
+
+			for (mem_size_t j = 0; j < i; j++)
+			{
+				if (waste[k - 1][j] == kNoSolution)
+				{
+					continue;
+				}
+
+				mem_size_t candidate = waste[k - 1][j] + GetWaste(j + 1, i);
+				if (candidate < waste[k][i])
+				{
+					waste[k][i] = candidate;
+					previous[k][i] = j;
+				}
+			}
+		}
+	}
+
+	mem_size_t bin = top_bin;
+	for (mem_size_t k = class_count; k > 0; k--)
+	{
+		block_sizes.emplace_back((bin + 1) << 4);
+		bin = previous[k][bin];
+	}
+	std::reverse(block_sizes.begin(), block_sizes.end());
+
+	mem_size_t total_waste = waste[class_count][top_bin];
+	expected_waste = (double)total_waste / (double)(total_waste + byte_sums[top_bin + 1]);
+}
+
+double SlabAllocator::GetHistogramWaste(const std::vector<mem_size_t>& block_sizes)
+{
+	// over the whole histogram like DeriveClasses, sizes these classes don't serve are charged as fallback spans
+	mem_size_t requested_bytes = 0;
+	mem_size_t block_bytes = 0;
+	mem_size_t class_index = 0;
+
+	for (mem_size_t i = 0; i < histogram_.size(); i++)
+	{
+		mem_size_t bin_size = (i + 1) << 4;
+		requested_bytes += histogram_[i].bytes;
+
+		if (bin_size > block_sizes.back())
+		{
+			block_bytes += histogram_[i].count * (bin_size + kFallbackTagSize);
+			continue;
+		}
+
+		while (block_sizes[class_index] < bin_size)
+		{
+			class_index++;
+		}
+		block_bytes += histogram_[i].count * block_sizes[class_index];
+	}
+
+	return block_bytes == 0 ? 0.0 : (double)(block_bytes - requested_bytes) / (double)block_bytes;
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include "StackTrace.h"
+#include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <execinfo.h>
+#include <dlfcn.h>
+#endif
+
+void CaptureStackTrace(StackTrace& trace, const mem_size_t& skip)
+{
+	// skip this frame as well
+	mem_size_t frames_to_skip = skip + 1;
+
+#ifdef _WIN32
+	trace.depth = CaptureStackBackTrace(static_cast<DWORD>(frames_to_skip), static_cast<DWORD>(kMaxStackDepth), trace.frames, nullptr);
+#else
+	void* frames[kMaxStackDepth + 8];
+	int depth = backtrace(frames, static_cast<int>(kMaxStackDepth + 8));
+	trace.depth = 0;
+	for (int i = static_cast<int>(frames_to_skip); i < depth && trace.depth < kMaxStackDepth; i++)
+	{
+		trace.frames[trace.depth++] = frames[i];
+	}
+#endif
+}
+
+void SymbolizeFrame(void* frame, std::string& symbol)
+{
+#ifndef _WIN32
+	Dl_info info;
+	if (dladdr(frame, &info) != 0 && info.dli_sname != nullptr)
+	{
+		symbol = info.dli_sname;
+		return;
+	}
+#endif
+
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%p", frame);
+	symbol = buffer;
+}
\ No newline at end of file
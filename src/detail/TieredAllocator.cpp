@@ -0,0 +1,264 @@
+#include "TieredAllocator.h"
+#include "VirtualMemory.h"
+#include <assert.h>
+#include <string.h>
+
+constexpr mem_size_t TieredAllocator::kDefaultDirectThreshold;
+constexpr mem_size_t TieredAllocator::kDirectHeaderSize;
+
+TieredAllocator::TieredAllocator(const mem_size_t& slab_capacity, const mem_size_t& heap_capacity) :
+	TieredAllocator(slab_capacity,
+					heap_capacity,
+					kDefaultDirectThreshold)
+{}
+
+TieredAllocator::TieredAllocator(const mem_size_t& slab_capacity, const mem_size_t& heap_capacity, const mem_size_t& direct_threshold) :
+	slab_(slab_capacity),
+	heap_(heap_capacity),
+	direct_threshold_(direct_threshold),
+	guarded_pool_(nullptr),
+	direct_mappings_(nullptr)
+{
+	ResetHitCounts();
+}
+
+TieredAllocator::~TieredAllocator()
+{
+	while (direct_mappings_ != nullptr)
+	{
+		FreeDirect(reinterpret_cast<void*>(direct_mappings_->region->start_address + kDirectHeaderSize), direct_mappings_->region);
+	}
+}
+
+void* TieredAllocator::Allocate(const mem_size_t& size)
+{
+	assert(size > 0);
+
+	void* ptr = nullptr;
+
+	if (guarded_pool_ != nullptr && guarded_pool_->ShouldSample())
+	{
+		ptr = guarded_pool_->Allocate(size);
+		if (ptr != nullptr)
+		{
+			Hit(Tier::kGuarded);
+			return ptr;
+		}
+	}
+
+	// the slab sees everything it may ever serve, so adaptive classes can learn sizes above the current ones
+	if (size <= SlabAllocator::kMaxAdaptiveSize)
+	{
+		ptr = slab_.Allocate(size);
+		if (ptr != nullptr)
+		{
+			Hit(Tier::kSlab);
+			return ptr;
+		}
+	}
+
+	if (size < direct_threshold_)
+	{
+		ptr = heap_.Allocate(size);
+		if (ptr != nullptr)
+		{
+			Hit(Tier::kExplicitFreeList);
+			return ptr;
+		}
+	}
+
+	// huge requests bypass the pooled heap so they can't fragment it, exhausted tiers end up here as well.
+	// Unlike malloc'd memory direct mappings are in the page map, so Free can reject stray pointers.
+	ptr = AllocateDirect(size);
+	if (ptr != nullptr)
+	{
+		Hit(Tier::kDirect);
+	}
+
+	return ptr;
+}
+
+void* TieredAllocator::AllocateZeroed(const mem_size_t& size)
+{
+	assert(size > 0);
+
+	void* ptr = nullptr;
+
+	if (guarded_pool_ != nullptr && guarded_pool_->ShouldSample())
+	{
+		ptr = guarded_pool_->Allocate(size);
+		if (ptr != nullptr)
+		{
+			Hit(Tier::kGuarded);
+			memset(ptr, 0, size);
+			return ptr;
+		}
+	}
+
+	if (size <= SlabAllocator::kMaxAdaptiveSize)
+	{
+		ptr = slab_.Allocate(size);
+		if (ptr != nullptr)
+		{
+			Hit(Tier::kSlab);
+			memset(ptr, 0, size);
+			return ptr;
+		}
+	}
+
+	if (size < direct_threshold_)
+	{
+		ptr = heap_.AllocateZeroed(size);
+		if (ptr != nullptr)
+		{
+			Hit(Tier::kExplicitFreeList);
+			return ptr;
+		}
+	}
+
+	// freshly mapped pages are already zero
+	ptr = AllocateDirect(size);
+	if (ptr != nullptr)
+	{
+		Hit(Tier::kDirect);
+	}
+
+	return ptr;
+}
+
+void TieredAllocator::Free(void* ptr)
+{
+	if (ptr == nullptr)
+	{
+		return;
+	}
+
+	// every tier registers its memory, anything else is a stray pointer
+	const Region* region = PageMap::Instance().Lookup(reinterpret_cast<mem_size_t>(ptr));
+	assert(region != nullptr);
+	if (region == nullptr)
+	{
+		return;
+	}
+
+	// guarded slots may come from a pool shared with other allocators, every other region must be one of ours
+	if (region->kind == HeapKind::kGuarded)
+	{
+		static_cast<GuardedPool*>(region->owner)->Free(ptr);
+		return;
+	}
+
+	if (region->owner == &slab_)
+	{
+		slab_.Free(ptr, region);
+	}
+	else if (region->owner == &heap_)
+	{
+		heap_.Free(ptr, region);
+	}
+	else if (region->owner == this)
+	{
+		FreeDirect(ptr, region);
+	}
+	else
+	{
+		// memory of another allocator, freeing it here would corrupt that allocator
+		assert(false);
+	}
+}
+
+mem_size_t TieredAllocator::GetHitCount(const Tier& tier)
+{
+	assert(tier != Tier::kCount);
+	return hit_counts_[static_cast<mem_size_t>(tier)];
+}
+
+void TieredAllocator::ResetHitCounts()
+{
+	for (auto& count : hit_counts_)
+	{
+		count = 0;
+	}
+}
+
+void TieredAllocator::SetGuardedPool(GuardedPool* guarded_pool)
+{
+	guarded_pool_ = guarded_pool;
+}
+
+void TieredAllocator::EnableAdaptiveSizeClasses(const mem_size_t& warmup_samples, const mem_size_t& class_count)
+{
+	slab_.EnableAdaptiveClasses(warmup_samples, class_count);
+}
+
+void TieredAllocator::DumpSizeClasses(std::ostream& out)
+{
+	slab_.DumpSizeClasses(out);
+}
+
+void* TieredAllocator::AllocateDirect(const mem_size_t& size)
+{
+	mem_size_t mapped_size = RoundUp(kPageSize, size + kDirectHeaderSize);
+	void* base = VirtualMemory::Map(mapped_size);
+	if (base == nullptr)
+	{
+		return nullptr;
+	}
+
+	DirectMapping* mapping = reinterpret_cast<DirectMapping*>(base);
+	mapping->prev = nullptr;
+	mapping->next = direct_mappings_;
+	if (direct_mappings_ != nullptr)
+	{
+		direct_mappings_->prev = mapping;
+	}
+	direct_mappings_ = mapping;
+
+	Region* region = PageMap::Instance().NewRegion();
+	mapping->region = region;
+	region->kind = HeapKind::kDirect;
+	region->owner = this;
+	region->start_address = reinterpret_cast<mem_size_t>(base);
+	region->end_address = region->start_address + mapped_size;
+	region->size_class = 0;
+	region->mapped_size = mapped_size;
+	PageMap::Instance().Register(region);
+
+	return reinterpret_cast<void*>(region->start_address + kDirectHeaderSize);
+}
+
+void TieredAllocator::FreeDirect(void* ptr, const Region* region)
+{
+	assert(region->owner == this);
+	assert(reinterpret_cast<mem_size_t>(ptr) == region->start_address + kDirectHeaderSize);
+
+	if (region->owner != this || reinterpret_cast<mem_size_t>(ptr) != region->start_address + kDirectHeaderSize)
+	{
+		return;
+	}
+
+	DirectMapping* mapping = reinterpret_cast<DirectMapping*>(region->start_address);
+	if (mapping->prev != nullptr)
+	{
+		mapping->prev->next = mapping->next;
+	}
+	else
+	{
+		direct_mappings_ = mapping->next;
+	}
+	if (mapping->next != nullptr)
+	{
+		mapping->next->prev = mapping->prev;
+	}
+
+	void* base = reinterpret_cast<void*>(region->start_address);
+	mem_size_t mapped_size = region->mapped_size;
+	PageMap::Instance().Unregister(region);
+	PageMap::Instance().DeleteRegion(mapping->region);
+	VirtualMemory::Unmap(base, mapped_size);
+}
+
+inline void TieredAllocator::Hit(const Tier& tier)
+{
+	hit_counts_[static_cast<mem_size_t>(tier)]++;
+}
\ No newline at end of file
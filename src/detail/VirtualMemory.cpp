@@ -0,0 +1,261 @@
+#include "VirtualMemory.h"
+#include <chrono>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#endif
+
+namespace VirtualMemory
+{
+	void* Map(const mem_size_t& size)
+	{
+		mem_size_t page_aligned_size = RoundUp(kPageSize, size);
+#ifdef _WIN32
+		return VirtualAlloc(nullptr, page_aligned_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+		void* ptr = mmap(nullptr, page_aligned_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return ptr == MAP_FAILED ? nullptr : ptr;
+#endif
+	}
+
+	void Unmap(void* ptr, const mem_size_t& size)
+	{
+		if (ptr == nullptr)
+		{
+			return;
+		}
+
+#ifdef _WIN32
+		(void)size;
+		VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+		munmap(ptr, RoundUp(kPageSize, size));
+#endif
+	}
+
+	bool Protect(void* ptr, const mem_size_t& size, bool accessible)
+	{
+#ifdef _WIN32
+		DWORD old_protect;
+		return VirtualProtect(ptr, RoundUp(kPageSize, size), accessible ? PAGE_READWRITE : PAGE_NOACCESS, &old_protect) != 0;
+#else
+		return mprotect(ptr, RoundUp(kPageSize, size), accessible ? (PROT_READ | PROT_WRITE) : PROT_NONE) == 0;
+#endif
+	}
+
+	void Purge(void* ptr, const mem_size_t& size)
+	{
+#ifdef _WIN32
+		VirtualFree(ptr, size, MEM_DECOMMIT);
+		VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE);
+#else
+		madvise(ptr, size, MADV_DONTNEED);
+#endif
+	}
+
+	bool MapFile(const char* path, const mem_size_t& size, MappedFile& mapped_file)
+	{
+		mapped_file.address = nullptr;
+		mapped_file.size = 0;
+		mapped_file.created = false;
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		LARGE_INTEGER file_size;
+		GetFileSizeEx(file, &file_size);
+		mapped_file.created = file_size.QuadPart == 0;
+		mapped_file.size = mapped_file.created ? RoundUp(kPageSize, size) : static_cast<mem_size_t>(file_size.QuadPart);
+
+		// the mapping grows a new file to the requested size, zero-filled
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE,
+											static_cast<DWORD>(static_cast<uint64_t>(mapped_file.size) >> 32),
+											static_cast<DWORD>(mapped_file.size & 0xffffffff),
+											nullptr);
+		if (mapping == nullptr)
+		{
+			CloseHandle(file);
+			return false;
+		}
+
+		mapped_file.address = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, mapped_file.size);
+		if (mapped_file.address == nullptr)
+		{
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return false;
+		}
+
+		mapped_file.file = reinterpret_cast<intptr_t>(file);
+		mapped_file.mapping = reinterpret_cast<intptr_t>(mapping);
+#else
+		int fd = open(path, O_RDWR | O_CREAT, 0644);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		struct stat file_stat;
+		fstat(fd, &file_stat);
+		mapped_file.created = file_stat.st_size == 0;
+		mapped_file.size = mapped_file.created ? RoundUp(kPageSize, size) : static_cast<mem_size_t>(file_stat.st_size);
+
+		// a sparse file reads back as zeros
+		if (mapped_file.created && ftruncate(fd, static_cast<off_t>(mapped_file.size)) != 0)
+		{
+			close(fd);
+			return false;
+		}
+
+		void* ptr = mmap(nullptr, mapped_file.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (ptr == MAP_FAILED)
+		{
+			close(fd);
+			return false;
+		}
+
+		mapped_file.address = ptr;
+		mapped_file.file = fd;
+		mapped_file.mapping = 0;
+#endif
+
+		return true;
+	}
+
+	void FlushFile(MappedFile& mapped_file)
+	{
+		if (mapped_file.address == nullptr)
+		{
+			return;
+		}
+
+#ifdef _WIN32
+		FlushViewOfFile(mapped_file.address, mapped_file.size);
+		if (reinterpret_cast<HANDLE>(mapped_file.file) != INVALID_HANDLE_VALUE)
+		{
+			FlushFileBuffers(reinterpret_cast<HANDLE>(mapped_file.file));
+		}
+#else
+		msync(mapped_file.address, mapped_file.size, MS_SYNC);
+#endif
+	}
+
+	void UnmapFile(MappedFile& mapped_file)
+	{
+		if (mapped_file.address == nullptr)
+		{
+			return;
+		}
+
+		FlushFile(mapped_file);
+
+#ifdef _WIN32
+		UnmapViewOfFile(mapped_file.address);
+		CloseHandle(reinterpret_cast<HANDLE>(mapped_file.mapping));
+		if (reinterpret_cast<HANDLE>(mapped_file.file) != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(reinterpret_cast<HANDLE>(mapped_file.file));
+		}
+#else
+		munmap(mapped_file.address, mapped_file.size);
+		close(static_cast<int>(mapped_file.file));
+#endif
+
+		mapped_file.address = nullptr;
+	}
+
+	bool MapShared(const char* name, const mem_size_t& size, const mem_size_t& timeout_milliseconds, MappedFile& mapped_file)
+	{
+		mapped_file.address = nullptr;
+		mapped_file.size = RoundUp(kPageSize, size);
+		mapped_file.created = false;
+
+#ifdef _WIN32
+		HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+											static_cast<DWORD>(static_cast<uint64_t>(mapped_file.size) >> 32),
+											static_cast<DWORD>(mapped_file.size & 0xffffffff),
+											name);
+		if (mapping == nullptr)
+		{
+			return false;
+		}
+		mapped_file.created = GetLastError() != ERROR_ALREADY_EXISTS;
+
+		mapped_file.address = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, mapped_file.size);
+		if (mapped_file.address == nullptr)
+		{
+			CloseHandle(mapping);
+			return false;
+		}
+
+		mapped_file.file = reinterpret_cast<intptr_t>(INVALID_HANDLE_VALUE);
+		mapped_file.mapping = reinterpret_cast<intptr_t>(mapping);
+#else
+		int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd >= 0)
+		{
+			mapped_file.created = true;
+			if (ftruncate(fd, static_cast<off_t>(mapped_file.size)) != 0)
+			{
+				close(fd);
+				shm_unlink(name);
+				return false;
+			}
+		}
+		else
+		{
+			fd = shm_open(name, O_RDWR, 0600);
+			if (fd < 0)
+			{
+				return false;
+			}
+
+			// the creator may not have sized the segment yet, or died before it could
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_milliseconds);
+			struct stat segment_stat;
+			while (fstat(fd, &segment_stat) == 0 && segment_stat.st_size == 0)
+			{
+				if (std::chrono::steady_clock::now() > deadline)
+				{
+					close(fd);
+					return false;
+				}
+				sched_yield();
+			}
+			mapped_file.size = static_cast<mem_size_t>(segment_stat.st_size);
+		}
+
+		void* ptr = mmap(nullptr, mapped_file.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (ptr == MAP_FAILED)
+		{
+			close(fd);
+			return false;
+		}
+
+		mapped_file.address = ptr;
+		mapped_file.file = fd;
+		mapped_file.mapping = 0;
+#endif
+
+		return true;
+	}
+
+	void UnlinkShared(const char* name)
+	{
+#ifdef _WIN32
+		// named mappings vanish with their last handle
+		(void)name;
+#else
+		shm_unlink(name);
+#endif
+	}
+}
\ No newline at end of file
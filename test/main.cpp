@@ -2,9 +2,26 @@
 #include <string>
 #include "ExplicitFreeListAllocator.h"
 #include "CrtAllocator.h"
+#include "TieredAllocator.h"
+#include "SlabAllocator.h"
+#include "HeapProfiler.h"
+#include "GuardedPool.h"
+#include "SharedHeap.h"
 #include <chrono>
 #include <vector>
 #include <iomanip>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <queue>
+#include <functional>
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
 
 using namespace std;
 
@@ -34,7 +51,8 @@ public:
 	}
 };
 
-Statistics AllocateAndFree(string title, ExplicitFreeListAllocator* allocator, vector<mem_size_t> allocation_sizes)
+template<typename TAllocator>
+Statistics AllocateAndFree(string title, TAllocator* allocator, vector<mem_size_t> allocation_sizes)
 {
 	Statistics ret(title);
 
@@ -57,7 +75,8 @@ Statistics AllocateAndFree(string title, ExplicitFreeListAllocator* allocator, v
 	return ret;
 }
 
-Statistics RandomAllocateAndFree(string title, ExplicitFreeListAllocator* allocator, vector<mem_size_t> allocation_sizes)
+template<typename TAllocator>
+Statistics RandomAllocateAndFree(string title, TAllocator* allocator, vector<mem_size_t> allocation_sizes)
 {
 	Statistics ret(title);
 
@@ -81,11 +100,709 @@ Statistics RandomAllocateAndFree(string title, ExplicitFreeListAllocator* alloca
 	return ret;
 }
 
+template<typename TAllocator>
+Statistics RepeatedAllocateAndFree(string title, TAllocator* allocator, vector<mem_size_t> allocation_sizes, mem_size_t rounds)
+{
+	Statistics ret(title);
+	ret.allocation_time_ = 0.0;
+	ret.free_time_ = 0.0;
+
+	vector<void*> addresses;
+	addresses.reserve(allocation_sizes.size());
+	for (mem_size_t round = 0; round < rounds; round++)
+	{
+		addresses.clear();
+
+		auto start = chrono::steady_clock::now();
+		for (auto& size : allocation_sizes)
+		{
+			addresses.emplace_back(allocator->Allocate(size));
+		}
+		ret.allocation_time_ += (double)(chrono::steady_clock::now() - start).count() / 1e+3f;
+
+		start = chrono::steady_clock::now();
+		for (auto& addr : addresses)
+		{
+			allocator->Free(addr);
+		}
+		ret.free_time_ += (double)(chrono::steady_clock::now() - start).count() / 1e+3f;
+	}
+	ret.execution_times_ = allocation_sizes.size() * rounds;
+
+	return ret;
+}
+
+void DumpTierHits(TieredAllocator* allocator)
+{
+	cout << "Tier Hits: slab " << allocator->GetHitCount(Tier::kSlab)
+		<< ", explicit free list " << allocator->GetHitCount(Tier::kExplicitFreeList)
+		<< ", direct " << allocator->GetHitCount(Tier::kDirect)
+		<< ", guarded " << allocator->GetHitCount(Tier::kGuarded) << endl;
+	allocator->ResetHitCounts();
+}
+
+void CompactFragmentedHeap(string title, mem_size_t capacity, vector<mem_size_t> allocation_sizes, mem_size_t budget)
+{
+	typedef ExplicitFreeListAllocator::Handle Handle;
+
+	ExplicitFreeListAllocator* allocator = new ExplicitFreeListAllocator(capacity);
+
+	// interleave live and dead spans until the heap is full
+	vector<Handle> handles;
+	for (mem_size_t i = 0; ; i++)
+	{
+		Handle handle = allocator->AllocateMovable(allocation_sizes[i % allocation_sizes.size()]);
+		if (handle == ExplicitFreeListAllocator::kInvalidHandle)
+		{
+			break;
+		}
+		handles.emplace_back(handle);
+	}
+
+	for (mem_size_t i = 0; i < handles.size(); i += 2)
+	{
+		allocator->FreeMovable(handles[i]);
+	}
+
+	mem_size_t largest_before = allocator->GetLargestFreeSpan();
+
+	mem_size_t slices = 1;
+	double max_slice_time = 0.0;
+	double total_time = 0.0;
+	while (true)
+	{
+		auto start = chrono::steady_clock::now();
+		bool done = allocator->Compact(budget);
+		double slice_time = (double)(chrono::steady_clock::now() - start).count() / 1e+3f;
+		max_slice_time = max(max_slice_time, slice_time);
+		total_time += slice_time;
+		if (done)
+		{
+			break;
+		}
+		slices++;
+	}
+
+	cout << "===========================================================================" << endl;
+	cout << "[" << title << "]" << endl;
+	cout << "Largest Free Span Before: " << largest_before << " Bytes" << endl;
+	cout << "Largest Free Span After: " << allocator->GetLargestFreeSpan() << " Bytes" << endl;
+	cout << "Slices: " << slices << " x " << budget << " Bytes Budget" << endl;
+	cout << "Compaction Time: " << setprecision(6) << total_time << " ms" << endl;
+	cout << "Max Slice Time: " << setprecision(6) << max_slice_time << " ms" << endl;
+	cout << "===========================================================================" << endl;
+
+	delete allocator;
+}
+
+// sparse users of calloc'ed buffers, e.g. hash tables and bitmaps, only touch a few pages of each.
+// purge_heap is purged after every round, nullptr leaves purging to the allocator
+template<typename TAllocator>
+double ZeroedBufferRounds(TAllocator* allocator, mem_size_t buffer_size, mem_size_t buffer_count, mem_size_t rounds, bool zeroed, ExplicitFreeListAllocator* purge_heap)
+{
+	vector<char*> buffers(buffer_count);
+
+	auto start = chrono::steady_clock::now();
+	for (mem_size_t round = 0; round < rounds; round++)
+	{
+		for (mem_size_t i = 0; i < buffer_count; i++)
+		{
+			if (zeroed)
+			{
+				buffers[i] = (char*)allocator->AllocateZeroed(buffer_size);
+			}
+			else
+			{
+				buffers[i] = (char*)allocator->Allocate(buffer_size);
+				memset(buffers[i], 0, buffer_size);
+			}
+
+			for (mem_size_t offset = 0; offset < buffer_size; offset += 16 * kPageSize)
+			{
+				buffers[i][offset] = 1;
+			}
+		}
+
+		for (mem_size_t i = 0; i < buffer_count; i++)
+		{
+			allocator->Free(buffers[i]);
+		}
+
+		if (purge_heap != nullptr)
+		{
+			purge_heap->Purge();
+		}
+	}
+
+	return (double)(chrono::steady_clock::now() - start).count() / 1e+3f;
+}
+
+void ZeroedAllocation(string title, mem_size_t buffer_size, mem_size_t buffer_count, mem_size_t rounds)
+{
+	mem_size_t capacity = (buffer_size + kPageSize) * buffer_count * 2;
+
+	ExplicitFreeListAllocator* allocator = new ExplicitFreeListAllocator(capacity);
+	double memset_time = ZeroedBufferRounds(allocator, buffer_size, buffer_count, rounds, false, nullptr);
+	delete allocator;
+
+	allocator = new ExplicitFreeListAllocator(capacity);
+	double zeroed_time = ZeroedBufferRounds(allocator, buffer_size, buffer_count, rounds, true, nullptr);
+	delete allocator;
+
+	allocator = new ExplicitFreeListAllocator(capacity);
+	double purged_time = ZeroedBufferRounds(allocator, buffer_size, buffer_count, rounds, true, allocator);
+	delete allocator;
+
+	// buffers past the direct threshold are mapped per request, so AllocateZeroed gets fresh pages without purging
+	TieredAllocator* tiered_allocator = new TieredAllocator(1 MB, 1 MB);
+	double tiered_memset_time = ZeroedBufferRounds(tiered_allocator, buffer_size, buffer_count, rounds, false, nullptr);
+	double tiered_zeroed_time = ZeroedBufferRounds(tiered_allocator, buffer_size, buffer_count, rounds, true, nullptr);
+	delete tiered_allocator;
+
+	cout << "===========================================================================" << endl;
+	cout << "[" << title << "]" << endl;
+	cout << "Buffers: " << rounds << " x " << buffer_count << " x " << buffer_size << " Bytes" << endl;
+	cout << "Allocate + memset: " << setprecision(6) << memset_time << " ms" << endl;
+	cout << "AllocateZeroed: " << setprecision(6) << zeroed_time << " ms" << endl;
+	cout << "AllocateZeroed + Purge: " << setprecision(6) << purged_time << " ms (the caller purges after every round)" << endl;
+	cout << "TieredAllocator Allocate + memset: " << setprecision(6) << tiered_memset_time << " ms" << endl;
+	cout << "TieredAllocator AllocateZeroed: " << setprecision(6) << tiered_zeroed_time << " ms (fresh direct mapped pages)" << endl;
+	cout << "===========================================================================" << endl;
+}
+
+// Synthetic server trace: a request buffer per step that dies within a few dozen steps,
+// plus a session object every 16 steps that lives for tens of thousands of steps.
+void ReplaySessionTrace(ExplicitFreeListAllocator* allocator, mem_size_t steps, mem_size_t checkpoints, bool hinted, vector<mem_size_t>& largest_free_spans, vector<double>& fragmentations)
+{
+	typedef pair<mem_size_t, void*> Expiry;
+	priority_queue<Expiry, vector<Expiry>, greater<Expiry>> live;
+
+	srand(1743);
+
+	for (mem_size_t step = 1; step <= steps; step++)
+	{
+		while (!live.empty() && live.top().first <= step)
+		{
+			allocator->Free(live.top().second);
+			live.pop();
+		}
+
+		mem_size_t request_size = 256 + rand() % (16 KB);
+		void* request = allocator->Allocate(request_size, hinted ? Lifetime::kShort : Lifetime::kDefault);
+		if (request != nullptr)
+		{
+			live.emplace(step + 1 + rand() % 64, request);
+		}
+
+		if (step % 16 == 0)
+		{
+			mem_size_t session_size = 512 + rand() % (4 KB);
+			void* session = allocator->Allocate(session_size, hinted ? Lifetime::kLong : Lifetime::kDefault);
+			if (session != nullptr)
+			{
+				live.emplace(step + 10000 + rand() % 40000, session);
+			}
+		}
+
+		if (step % (steps / checkpoints) == 0)
+		{
+			mem_size_t free_size = allocator->GetFreeSize();
+			mem_size_t largest = allocator->GetLargestFreeSpan();
+			largest_free_spans.emplace_back(largest);
+			fragmentations.emplace_back(free_size == 0 ? 0.0 : 1.0 - (double)largest / (double)free_size);
+		}
+	}
+
+	while (!live.empty())
+	{
+		allocator->Free(live.top().second);
+		live.pop();
+	}
+}
+
+void LifetimeHintedFragmentation(string title, mem_size_t capacity, mem_size_t steps, mem_size_t checkpoints)
+{
+	vector<mem_size_t> unhinted_largest, hinted_largest;
+	vector<double> unhinted_fragmentation, hinted_fragmentation;
+
+	ExplicitFreeListAllocator* allocator = new ExplicitFreeListAllocator(capacity);
+	ReplaySessionTrace(allocator, steps, checkpoints, false, unhinted_largest, unhinted_fragmentation);
+	delete allocator;
+
+	allocator = new ExplicitFreeListAllocator(capacity);
+	ReplaySessionTrace(allocator, steps, checkpoints, true, hinted_largest, hinted_fragmentation);
+	delete allocator;
+
+	cout << "===========================================================================" << endl;
+	cout << "[" << title << "]" << endl;
+	cout << "Step, Largest Free Span(Unhinted / Hinted), Fragmentation(Unhinted / Hinted)" << endl;
+	for (mem_size_t i = 0; i < unhinted_largest.size(); i++)
+	{
+		cout << (i + 1) * (steps / checkpoints) << ", "
+			 << unhinted_largest[i] << " / " << hinted_largest[i] << " Bytes, "
+			 << setprecision(3) << unhinted_fragmentation[i] * 100.0 << "% / " << hinted_fragmentation[i] * 100.0 << "%" << endl;
+	}
+	cout << "===========================================================================" << endl;
+}
+
+struct ListNode
+{
+	ListNode* next;
+	mem_size_t value;
+	char payload[48];
+};
+
+// builds a list on a heap whose free list was shuffled by random frees, returns the average distance between neighbours
+ListNode* BuildScatteredList(ExplicitFreeListAllocator* allocator, mem_size_t count, bool near, double& average_distance)
+{
+	srand(35);
+
+	vector<void*> fillers;
+	for (void* ptr = allocator->Allocate(16 + rand() % 256); ptr != nullptr; ptr = allocator->Allocate(16 + rand() % 256))
+	{
+		fillers.emplace_back(ptr);
+	}
+
+	// free a random half in random order, like a heap that has been churning for a while
+	for (mem_size_t i = fillers.size() - 1; i > 0; i--)
+	{
+		swap(fillers[i], fillers[rand() % (i + 1)]);
+	}
+
+	for (mem_size_t i = 0; i < fillers.size() / 2; i++)
+	{
+		allocator->Free(fillers[i]);
+	}
+
+	ListNode* head = (ListNode*)allocator->Allocate(sizeof(ListNode));
+	ListNode* tail = head;
+	head->value = 0;
+	double total_distance = 0.0;
+
+	for (mem_size_t i = 1; i < count; i++)
+	{
+		ListNode* node = (ListNode*)(near ? allocator->AllocateNear(tail, sizeof(ListNode)) : allocator->Allocate(sizeof(ListNode)));
+		if (node == nullptr)
+		{
+			break;
+		}
+		node->value = i;
+		tail->next = node;
+		total_distance += (double)(node > tail ? (mem_size_t)node - (mem_size_t)tail : (mem_size_t)tail - (mem_size_t)node);
+		tail = node;
+	}
+
+	tail->next = nullptr;
+	average_distance = total_distance / (double)(count - 1);
+	return head;
+}
+
+double TraverseList(ListNode* head, mem_size_t passes, mem_size_t& checksum)
+{
+	checksum = 0;
+
+	auto start = chrono::steady_clock::now();
+	for (mem_size_t pass = 0; pass < passes; pass++)
+	{
+		for (ListNode* node = head; node != nullptr; node = node->next)
+		{
+			checksum += node->value;
+		}
+	}
+
+	return (double)(chrono::steady_clock::now() - start).count() / 1e+3f;
+}
+
+void LocalityAwareTraversal(string title, mem_size_t capacity, mem_size_t count, mem_size_t passes)
+{
+	double first_fit_distance, near_distance;
+	mem_size_t first_fit_checksum, near_checksum;
+
+	ExplicitFreeListAllocator* allocator = new ExplicitFreeListAllocator(capacity);
+	ListNode* head = BuildScatteredList(allocator, count, false, first_fit_distance);
+	double first_fit_time = TraverseList(head, passes, first_fit_checksum);
+	delete allocator;
+
+	allocator = new ExplicitFreeListAllocator(capacity);
+	head = BuildScatteredList(allocator, count, true, near_distance);
+	double near_time = TraverseList(head, passes, near_checksum);
+	delete allocator;
+
+	cout << "===========================================================================" << endl;
+	cout << "[" << title << "]" << endl;
+	cout << "Nodes: " << count << ", Passes: " << passes << ", Checksum: " << (first_fit_checksum == near_checksum ? "ok" : "mismatch") << endl;
+	cout << "Average Link Distance(Allocate / AllocateNear): " << setprecision(6) << first_fit_distance << " / " << near_distance << " Bytes" << endl;
+	cout << "Traversal Time(Allocate): " << setprecision(6) << first_fit_time << " ms" << endl;
+	cout << "Traversal Time(AllocateNear): " << setprecision(6) << near_time << " ms" << endl;
+	cout << "===========================================================================" << endl;
+}
+
+// sizes clustering just above power-of-two boundaries, plus a little uniform noise
+mem_size_t NextClusteredSize()
+{
+	static const mem_size_t kClusters[] = { 72, 136, 520 };
+
+	if (rand() % 10 == 0)
+	{
+		return 16 + rand() % (1 KB - 16);
+	}
+
+	return kClusters[rand() % 3] - rand() % 8;
+}
+
+mem_size_t FillSlab(SlabAllocator* slab, mem_size_t count, mem_size_t& requested_bytes)
+{
+	srand(36);
+
+	mem_size_t served = 0;
+	requested_bytes = 0;
+	for (mem_size_t i = 0; i < count; i++)
+	{
+		mem_size_t size = NextClusteredSize();
+		if (slab->Allocate(size) != nullptr)
+		{
+			requested_bytes += size;
+			served++;
+		}
+	}
+
+	return served;
+}
+
+void AdaptiveSizeClasses(string title, mem_size_t capacity, mem_size_t count)
+{
+	// power-of-two classes stretched over the same range, the way a fixed fl/sl mapping would bin them
+	const mem_size_t kPowerOfTwoBlockSizes[] = { 16, 32, 64, 128, 256, 512, 1024 };
+
+	mem_size_t requested_bytes;
+	SlabAllocator* slab = new SlabAllocator(capacity, kPowerOfTwoBlockSizes, sizeof(kPowerOfTwoBlockSizes) / sizeof(mem_size_t));
+	mem_size_t served = FillSlab(slab, count, requested_bytes);
+	mem_size_t power_of_two_mapped = slab->GetMappedSize();
+	delete slab;
+
+	slab = new SlabAllocator(capacity, kPowerOfTwoBlockSizes, sizeof(kPowerOfTwoBlockSizes) / sizeof(mem_size_t));
+	slab->EnableAdaptiveClasses(4096, 8);
+	FillSlab(slab, count, requested_bytes);
+
+	cout << "===========================================================================" << endl;
+	cout << "[" << title << "]" << endl;
+	slab->DumpSizeClasses(cout);
+	cout << "Objects: " << served << ", Requested: " << requested_bytes << " Bytes" << endl;
+	cout << "Mapped(Power Of Two / Adaptive): " << power_of_two_mapped << " / " << slab->GetMappedSize() << " Bytes" << endl;
+	cout << "===========================================================================" << endl;
+
+	delete slab;
+}
+
+struct PersistentNode
+{
+	mem_size_t next;
+	mem_size_t value;
+};
+
+// builds a linked list with offset links, returns the head
+PersistentNode* BuildPersistentList(ExplicitFreeListAllocator* allocator, mem_size_t count)
+{
+	PersistentNode* head = nullptr;
+	PersistentNode* tail = nullptr;
+	for (mem_size_t i = 0; i < count; i++)
+	{
+		PersistentNode* node = reinterpret_cast<PersistentNode*>(allocator->Allocate(sizeof(PersistentNode)));
+		node->next = 0;
+		node->value = i;
+		if (tail != nullptr)
+		{
+			tail->next = reinterpret_cast<mem_size_t>(node) - reinterpret_cast<mem_size_t>(head);
+		}
+		else
+		{
+			head = node;
+		}
+		tail = node;
+	}
+	return head;
+}
+
+void PersistentHeapStartup(string title, const char* path, mem_size_t capacity, mem_size_t count)
+{
+	remove(path);
+
+	ExplicitFreeListAllocator* allocator = new ExplicitFreeListAllocator(path, capacity);
+	allocator->SetRoot(BuildPersistentList(allocator, count));
+	delete allocator;
+
+	// warm restart: remap the file and pick up the root
+	auto start = chrono::steady_clock::now();
+	allocator = new ExplicitFreeListAllocator(path, capacity);
+	PersistentNode* head = reinterpret_cast<PersistentNode*>(allocator->GetRoot());
+	double attach_time = (double)(chrono::steady_clock::now() - start).count() / 1e+3f;
+
+	mem_size_t sum = 0;
+	for (PersistentNode* node = head; ; node = reinterpret_cast<PersistentNode*>(reinterpret_cast<mem_size_t>(head) + node->next))
+	{
+		sum += node->value;
+		if (node->next == 0)
+		{
+			break;
+		}
+	}
+	bool warm_start = allocator->IsWarmStart();
+	delete allocator;
+	remove(path);
+
+	// cold start: rebuild the same state in a fresh heap
+	start = chrono::steady_clock::now();
+	allocator = new ExplicitFreeListAllocator(capacity);
+	BuildPersistentList(allocator, count);
+	double rebuild_time = (double)(chrono::steady_clock::now() - start).count() / 1e+3f;
+	delete allocator;
+
+	cout << "===========================================================================" << endl;
+	cout << "[" << title << "]" << endl;
+	cout << "Objects: " << count << ", Warm Start: " << (warm_start ? "yes" : "no") << ", Checksum: " << (sum == count * (count - 1) / 2 ? "ok" : "mismatch") << endl;
+	cout << "Attach Time: " << setprecision(6) << attach_time << " ms" << endl;
+	cout << "Rebuild Time: " << setprecision(6) << rebuild_time << " ms" << endl;
+	cout << "===========================================================================" << endl;
+}
+
+#ifndef _WIN32
+constexpr mem_size_t kMessageRingLength = 64;
+
+struct MessageRing
+{
+	std::atomic<mem_size_t> head;
+	std::atomic<mem_size_t> tail;
+	mem_size_t messages[kMessageRingLength];
+};
+
+void ConsumeSharedMessages(const char* name, mem_size_t capacity, mem_size_t message_size, mem_size_t message_count)
+{
+	SharedHeap* heap = new SharedHeap(name, capacity);
+	MessageRing* ring = reinterpret_cast<MessageRing*>(heap->ToPointer(heap->GetRoot()));
+
+	mem_size_t checksum = 0;
+	for (mem_size_t i = 0; i < message_count; i++)
+	{
+		mem_size_t head = ring->head.load(memory_order_relaxed);
+		while (ring->tail.load(memory_order_acquire) == head)
+		{
+			this_thread::yield();
+		}
+
+		mem_size_t offset = ring->messages[head % kMessageRingLength];
+		const unsigned char* message = reinterpret_cast<const unsigned char*>(heap->ToPointer(offset));
+		checksum += message[0] + message[message_size - 1];
+		heap->Free(offset);
+		ring->head.store(head + 1, memory_order_release);
+	}
+
+	// leak one message on purpose, the producer reclaims it after we are gone
+	heap->Allocate(message_size);
+
+	delete heap;
+	_exit(checksum == message_count * 2 ? 0 : 1);
+}
+
+void SharedHeapMessaging(string title, mem_size_t message_size, mem_size_t message_count)
+{
+	const char* name = "/memory_allocator_benchmark";
+	const mem_size_t capacity = 64 MB;
+
+	SharedHeap::Unlink(name);
+	SharedHeap* heap = new SharedHeap(name, capacity);
+	mem_size_t ring_offset = heap->Allocate(sizeof(MessageRing));
+	MessageRing* ring = new (heap->ToPointer(ring_offset)) MessageRing();
+	ring->head.store(0);
+	ring->tail.store(0);
+	heap->SetRoot(ring_offset);
+
+	// zero copy: hand over offsets through the ring, the consumer frees
+	auto start = chrono::steady_clock::now();
+	pid_t consumer = fork();
+	if (consumer == 0)
+	{
+		ConsumeSharedMessages(name, capacity, message_size, message_count);
+	}
+
+	for (mem_size_t i = 0; i < message_count; i++)
+	{
+		mem_size_t offset;
+		while ((offset = heap->Allocate(message_size)) == SharedHeap::kNullOffset)
+		{
+			this_thread::yield();
+		}
+		memset(heap->ToPointer(offset), 1, message_size);
+
+		mem_size_t tail = ring->tail.load(memory_order_relaxed);
+		while (tail - ring->head.load(memory_order_acquire) == kMessageRingLength)
+		{
+			this_thread::yield();
+		}
+		ring->messages[tail % kMessageRingLength] = offset;
+		ring->tail.store(tail + 1, memory_order_release);
+	}
+
+	int status = 0;
+	waitpid(consumer, &status, 0);
+	double shared_time = (double)(chrono::steady_clock::now() - start).count() / 1e+9f;
+	mem_size_t reclaimed = heap->ReclaimDeadProcesses();
+
+	heap->Free(ring_offset);
+	delete heap;
+	SharedHeap::Unlink(name);
+
+	// copy based: the same messages through a socket
+	int sockets[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+	vector<unsigned char> buffer(message_size, 1);
+
+	start = chrono::steady_clock::now();
+	consumer = fork();
+	if (consumer == 0)
+	{
+		close(sockets[0]);
+		mem_size_t remaining = message_size * message_count;
+		while (remaining > 0)
+		{
+			ssize_t received = read(sockets[1], buffer.data(), min(remaining, message_size));
+			if (received <= 0)
+			{
+				_exit(1);
+			}
+			remaining -= received;
+		}
+		_exit(0);
+	}
+
+	close(sockets[1]);
+	for (mem_size_t i = 0; i < message_count; i++)
+	{
+		memset(buffer.data(), 1, message_size);
+		mem_size_t sent = 0;
+		while (sent < message_size)
+		{
+			ssize_t written = write(sockets[0], buffer.data() + sent, message_size - sent);
+			if (written <= 0)
+			{
+				break;
+			}
+			sent += written;
+		}
+	}
+	close(sockets[0]);
+
+	int socket_status = 0;
+	waitpid(consumer, &socket_status, 0);
+	double socket_time = (double)(chrono::steady_clock::now() - start).count() / 1e+9f;
+
+	double total_mb = (double)(message_size * message_count) / (double)(1 MB);
+	cout << "===========================================================================" << endl;
+	cout << "[" << title << "]" << endl;
+	cout << "Messages: " << message_count << " x " << message_size << " Bytes, Consumer: " << (WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "ok" : "failed") << endl;
+	cout << "Shared Heap Throughput: " << setprecision(6) << total_mb / shared_time << " MB/s" << endl;
+	cout << "Socket Copy Throughput: " << setprecision(6) << total_mb / socket_time << " MB/s" << endl;
+	cout << "Reclaimed From Dead Consumer: " << reclaimed << " Bytes" << endl;
+	cout << "===========================================================================" << endl;
+}
+
+// splits and merges as fast as possible until killed, most of the time with the shared lock held
+void ChurnSharedHeap(const char* name, mem_size_t capacity)
+{
+	SharedHeap* heap = new SharedHeap(name, capacity);
+	mem_size_t live[64] = {};
+	for (mem_size_t i = 0;; i++)
+	{
+		mem_size_t& slot = live[rand() % 64];
+		if (slot != SharedHeap::kNullOffset)
+		{
+			heap->Free(slot);
+		}
+		slot = heap->Allocate(16 + rand() % (4 KB));
+	}
+}
+
+void SharedHeapCrashRecovery(string title, mem_size_t rounds)
+{
+	const char* name = "/memory_allocator_crash";
+	const mem_size_t capacity = 4 MB;
+
+	SharedHeap::Unlink(name);
+	SharedHeap* heap = new SharedHeap(name, capacity);
+	mem_size_t root = heap->Allocate(4 KB);
+	memset(heap->ToPointer(root), 0x5a, 4 KB);
+	heap->SetRoot(root);
+
+	// the heap header sits right behind the shared header page, it is only peeked at while nobody holds the lock
+	const ExplicitFreeListAllocator::HeapHeader* heap_header = reinterpret_cast<const ExplicitFreeListAllocator::HeapHeader*>(heap->ToPointer(kPageSize));
+
+	mem_size_t pending_rounds = 0;
+	mem_size_t failed_rounds = 0;
+	srand(3203);
+
+	for (mem_size_t round = 0; round < rounds; round++)
+	{
+		pid_t churner = fork();
+		if (churner == 0)
+		{
+			srand(static_cast<unsigned int>(round));
+			ChurnSharedHeap(name, capacity);
+		}
+
+		this_thread::sleep_for(chrono::microseconds(500 + rand() % 2000));
+		kill(churner, SIGKILL);
+		waitpid(churner, nullptr, 0);
+
+		// killed between BeginTagUpdate and EndTagUpdate, the next Lock has to undo the journaled span
+		if (heap_header->pending_end != ExplicitFreeListAllocator::kNullOffset)
+		{
+			pending_rounds++;
+		}
+
+		// recovery ran inside the first Lock, all the dead churner's blocks must coalesce back
+		try
+		{
+			heap->ReclaimDeadProcesses();
+			mem_size_t probe = heap->Allocate(capacity / 2);
+			const unsigned char* root_bytes = reinterpret_cast<const unsigned char*>(heap->ToPointer(heap->GetRoot()));
+			bool root_intact = heap->GetRoot() == root && root_bytes[0] == 0x5a && root_bytes[4 KB - 1] == 0x5a;
+			if (probe == SharedHeap::kNullOffset || !root_intact)
+			{
+				failed_rounds++;
+			}
+			if (probe != SharedHeap::kNullOffset)
+			{
+				heap->Free(probe);
+			}
+		}
+		catch (const exception&)
+		{
+			// the segment is poisoned, every further round would throw as well
+			failed_rounds += rounds - round;
+			break;
+		}
+	}
+
+	if (failed_rounds == 0)
+	{
+		heap->Free(root);
+	}
+	delete heap;
+	SharedHeap::Unlink(name);
+
+	cout << "===========================================================================" << endl;
+	cout << "[" << title << "]" << endl;
+	cout << "Killed Processes: " << rounds << ", Killed With A Split Or Merge Pending: " << pending_rounds << endl;
+	cout << "Recovery: " << (failed_rounds == 0 ? "ok" : "failed") << " (" << failed_rounds << " rounds lost free space or the root)" << endl;
+	cout << "===========================================================================" << endl;
+}
+#endif
+
 int main()
 {
 	ExplicitFreeListAllocator* allocator1 = new ExplicitFreeListAllocator(128 MB);
 	ExplicitFreeListAllocator* allocator2 = new ExplicitFreeListAllocator(128 MB);
 	CrtAllocator* default_allocator = new CrtAllocator();
+	TieredAllocator* tiered_allocator = new TieredAllocator(1 MB, 16 MB);
 
 	// below 128 bytes
 	vector<mem_size_t> small_allocation_sizes = { 1 BYTE, 3 BYTE, 4 BYTE, 7 BYTE, 8 BYTE, 16 BYTE, 27 BYTE, 32 BYTE, 57 BYTE, 64 BYTE, 77 BYTE, 96 BYTE};
@@ -96,9 +813,51 @@ int main()
 	AllocateAndFree("Small Size Allocation(ExplicitFreeListAllocator)", allocator1, small_allocation_sizes).Dump();
 	RandomAllocateAndFree("Random Small Size Allocation(ExplicitFreeListAllocator)", allocator2, small_allocation_sizes).Dump();
 
+	AllocateAndFree("Small Size Allocation(TieredAllocator)", tiered_allocator, small_allocation_sizes).Dump();
+	DumpTierHits(tiered_allocator);
+	AllocateAndFree("Large Size Allocation(TieredAllocator)", tiered_allocator, large_allocation_sizes).Dump();
+	DumpTierHits(tiered_allocator);
+	AllocateAndFree("Small Size Allocation(CrtAllocator)", default_allocator, small_allocation_sizes).Dump();
+	AllocateAndFree("Large Size Allocation(CrtAllocator)", default_allocator, large_allocation_sizes).Dump();
+
+	// routing overhead on a warm, steady state workload
+	RepeatedAllocateAndFree("Repeated Small Size Allocation(ExplicitFreeListAllocator)", allocator1, small_allocation_sizes, 10000).Dump();
+	RepeatedAllocateAndFree("Repeated Small Size Allocation(TieredAllocator)", tiered_allocator, small_allocation_sizes, 10000).Dump();
+	DumpTierHits(tiered_allocator);
+	RepeatedAllocateAndFree("Repeated Small Size Allocation(CrtAllocator)", default_allocator, small_allocation_sizes, 10000).Dump();
+
+	// sampling profiler overhead at the default sampling interval
+	HeapProfiler* profiler = new HeapProfiler();
+	RepeatedAllocateAndFree("Repeated Small Size Allocation(ExplicitFreeListAllocator)", allocator2, small_allocation_sizes, 10000).Dump();
+	allocator2->SetProfiler(profiler);
+	RepeatedAllocateAndFree("Repeated Small Size Allocation(ExplicitFreeListAllocator, Profiled)", allocator2, small_allocation_sizes, 10000).Dump();
+	cout << "[Cumulative Allocation Profile]" << endl;
+	profiler->DumpAllocations(cout);
+	allocator2->SetProfiler(nullptr);
+	delete profiler;
+
+	// guarded sampling overhead at the default sample rate
+	GuardedPool* guarded_pool = new GuardedPool();
+	allocator2->SetGuardedPool(guarded_pool);
+	RepeatedAllocateAndFree("Repeated Small Size Allocation(ExplicitFreeListAllocator, Guarded)", allocator2, small_allocation_sizes, 10000).Dump();
+	allocator2->SetGuardedPool(nullptr);
+	delete guarded_pool;
+
+	CompactFragmentedHeap("Incremental Compaction(ExplicitFreeListAllocator)", 16 MB, small_allocation_sizes, 64 KB);
+	ZeroedAllocation("Zeroed Allocation(ExplicitFreeListAllocator, TieredAllocator)", 4 MB, 8, 100);
+	LifetimeHintedFragmentation("Lifetime Hinted Fragmentation(ExplicitFreeListAllocator)", 32 MB, 200000, 8);
+	LocalityAwareTraversal("Locality Aware Traversal(ExplicitFreeListAllocator)", 64 MB, 100000, 20);
+	AdaptiveSizeClasses("Adaptive Size Classes(SlabAllocator)", 256 MB, 500000);
+	PersistentHeapStartup("Persistent Heap Startup(ExplicitFreeListAllocator)", "persistent_heap.bin", 64 MB, 1000000);
+#ifndef _WIN32
+	SharedHeapMessaging("Two Process Messaging(SharedHeap)", 1 MB, 2000);
+	SharedHeapCrashRecovery("Crash Recovery(SharedHeap)", 200);
+#endif
+
 	delete allocator1;
 	delete allocator2;
 	delete default_allocator;
+	delete tiered_allocator;
 
 	return 0;
 }